@@ -1,11 +1,12 @@
 import pytest
 import numpy as np
-from mapbuffer import MapBuffer, HEADER_LENGTH
+from mapbuffer import MapBuffer, MapBufferWriter, RemoteMapBuffer, HEADER_LENGTH, ValidationError
 import random
 
 @pytest.mark.parametrize("compress", (None, "gzip", "br", "zstd", "lzma"))
-def test_empty(compress):
-  mbuf = MapBuffer({}, compress=compress)
+@pytest.mark.parametrize("format_version", (0, 1))
+def test_empty(compress, format_version):
+  mbuf = MapBuffer({}, compress=compress, format_version=format_version)
   assert len(mbuf) == 0
   assert list(mbuf) == []
 
@@ -20,13 +21,15 @@ def test_empty(compress):
 
 
 @pytest.mark.parametrize("compress", (None, "gzip", "br", "zstd"))
-def test_full(compress):
+@pytest.mark.parametrize("format_version", (0, 1))
+def test_full(compress, format_version):
   data = { 
     random.randint(0, 1000000000): bytes([ 
       random.randint(0,255) for __ in range(random.randint(0,50)) 
     ]) for _ in range(10000) 
   }
-  mbuf = MapBuffer(data, compress=compress)
+  mbuf = MapBuffer(data, compress=compress, format_version=format_version)
+  assert mbuf.format_version == format_version
   assert set(data.keys()) == set(mbuf.keys())
   assert set(data) == set(mbuf)
   assert set(data.values()) == set(mbuf.values())
@@ -49,4 +52,1041 @@ def test_full(compress):
 
   mbuf.validate()
 
-  assert len(mbuf.buffer) > HEADER_LENGTH
\ No newline at end of file
+  assert len(mbuf.buffer) > HEADER_LENGTH
+
+def test_getmany():
+  data = { 
+    random.randint(0, 1000000000): bytes([ 
+      random.randint(0,255) for __ in range(random.randint(0,50)) 
+    ]) for _ in range(1000) 
+  }
+  mbuf = MapBuffer(data)
+
+  labels = list(data.keys()) + [ lbl for lbl in range(100) if lbl not in data ]
+  random.shuffle(labels)
+
+  positions = mbuf.find_index_positions(labels)
+  for label, pos in zip(labels, positions):
+    if label in data:
+      assert pos == mbuf.find_index_position(label)
+    else:
+      assert pos == -1
+
+  values = mbuf.getmany(labels)
+  for label, value in zip(labels, values):
+    assert value == data.get(label, None)
+
+  assert MapBuffer({}).getmany([ 1, 2, 3 ]) == [ None, None, None ]
+
+def test_getview():
+  data = { 1: b"hello", 2: b"", 3: b"world" }
+  mbuf = MapBuffer(data)
+  for label, value in data.items():
+    view = mbuf.getview(label)
+    assert isinstance(view, memoryview)
+    assert view == value
+  assert mbuf.getview(4) is None
+  assert mbuf.get(4, b"x") == b"x"
+
+  mbuf = MapBuffer(data, compress="gzip")
+  assert mbuf.getview(1) != b"hello"
+  assert mbuf[1] == b"hello"
+
+def test_format_version_1_layout():
+  data = { 5: b"five", 1: b"one", 9: b"nine" }
+  mbuf = MapBuffer(data, format_version=1, compact_index=False)
+  buf = mbuf.tobytes()
+
+  assert buf[7] == 1
+  assert buf[16:72] == b"\x00" * 56
+  labels = np.frombuffer(buf, dtype=np.uint64, count=3, offset=72)
+  assert list(labels) == [ 5, 1, 9 ] # eytzinger order
+  assert np.all(mbuf.labels() == labels)
+  assert np.all(mbuf.index()[:,0] == labels)
+  assert mbuf.offsets()[0] == 72 + 3 * 2 * 8
+
+  v0 = MapBuffer(data, format_version=0)
+  assert np.all(v0.labels() == mbuf.labels())
+  assert np.all(v0.offsets() + (64 - HEADER_LENGTH + 8) == mbuf.offsets())
+  assert v0.todict() == mbuf.todict()
+
+  corrupt = bytearray(buf)
+  corrupt[20] = 1
+  try:
+    MapBuffer.validate_buffer(bytes(corrupt))
+    assert False
+  except ValidationError:
+    pass
+
+def test_compact_index():
+  from mapbuffer.mapbuffer import LABELS_UINT32, OFFSETS_UINT32
+
+  data = { 5: b"five", 1: b"one", 9: b"nine" }
+  mbuf = MapBuffer(data, format_version=1)
+  buf = mbuf.tobytes()
+  assert mbuf.index_flags == LABELS_UINT32 | OFFSETS_UINT32
+  assert mbuf.keys_array().dtype == np.uint32
+  assert mbuf.labels().dtype == np.uint64
+  assert list(mbuf.labels()) == [ 5, 1, 9 ]
+  assert all(( type(label) is np.uint64 for label in mbuf.keys() ))
+  assert all(( type(label) is np.uint64 for label, value in mbuf.items() ))
+  assert list(np.frombuffer(buf, dtype=np.uint32, count=3, offset=68)) == [ 5, 1, 9 ]
+  # labels: 4 * 4 bytes, offsets: 3 * 4 bytes padded to 16
+  assert mbuf.offsets()[0] == 64 + 16 + 16
+  assert len(buf) == 64 + 16 + 16 + len(b"fiveonenine")
+  assert mbuf.todict() == data
+  mbuf.validate()
+
+  big_label = { 2**40: b"big", 3: b"small" }
+  mbuf = MapBuffer(big_label, format_version=1)
+  assert mbuf.index_flags == OFFSETS_UINT32
+  assert mbuf.keys_array().dtype == np.uint64
+  assert mbuf[2**40] == b"big"
+  assert mbuf.get(2**32 + 3) is None
+  mbuf.validate()
+
+  for compact_index in (True, False):
+    data = { 
+      random.randint(0, 2**32 - 1): bytes([ 
+        random.randint(0,255) for __ in range(random.randint(0,50)) 
+      ]) for _ in range(3000) 
+    }
+    mbuf = MapBuffer(data, compress="gzip", format_version=1, compact_index=compact_index)
+    assert (mbuf.index_flags != 0) == compact_index
+    mbuf.validate()
+    assert mbuf.todict() == data
+    labels = list(data.keys())[:200] + [ 2**32, 2**32 + 1 ]
+    assert mbuf.getmany(labels) == [ data.get(lbl) for lbl in labels ]
+    raw = MapBuffer(data, format_version=1, compact_index=compact_index)
+    assert raw.getmany(labels) == [ data.get(lbl) for lbl in labels ]
+    assert raw[labels[0]] == data[labels[0]]
+    assert labels[-1] not in raw
+
+@pytest.mark.parametrize("compress", (None, "gzip"))
+@pytest.mark.parametrize("checksums", (False, True))
+def test_hash_index(compress, checksums):
+  from mapbuffer.mapbuffer import HASH_INDEX
+
+  for n in (0, 1, 2, 5, 3000):
+    data = {
+      random.randint(0, 2**40): bytes([
+        random.randint(0,255) for __ in range(random.randint(0,50))
+      ]) for _ in range(n)
+    }
+    mbuf = MapBuffer(
+      data, compress=compress, format_version=1, 
+      checksums=checksums, hash_index=True
+    )
+    assert mbuf.index_flags & HASH_INDEX
+    mbuf.validate()
+    plain = MapBuffer(data, compress=compress, format_version=1, checksums=checksums)
+    assert len(mbuf.tobytes()) > len(plain.tobytes()) or n == 0
+
+    labels = list(data.keys())[:200] + [ 2**41, 2**41 + 1 ]
+    assert mbuf.getmany(labels) == [ data.get(lbl) for lbl in labels ]
+    assert list(mbuf.find_index_positions(labels)) == list(plain.find_index_positions(labels))
+    for label in labels[:20]:
+      assert mbuf.get(label) == data.get(label)
+      assert (label in mbuf) == (label in data)
+    assert mbuf.todict() == data
+    assert list(mbuf.keys(sorted=True)) == sorted(data)
+
+    if n > 2:
+      subset = mbuf.subset(labels[:10])
+      assert subset.index_flags & HASH_INDEX
+      assert subset.todict() == { lbl: data[lbl] for lbl in labels[:10] }
+
+  # a displaced slot no longer resolves its label
+  mbuf = MapBuffer(data, format_version=1, hash_index=True, checksums=checksums)
+  buf = bytearray(mbuf.tobytes())
+  from mapbuffer.mapbuffer import index_layout, hash_index_shape
+  layout = index_layout(1, len(data), mbuf.index_flags)
+  buckets, size = hash_index_shape(len(data))
+  start = layout.hash + 8 + ((4 * buckets + 7) & ~7)
+  slots = np.frombuffer(buf, dtype=np.uint32, count=size, offset=start).copy()
+  filled = np.flatnonzero(slots != 0xffffffff)[:2]
+  slots[filled] = slots[filled[::-1]]
+  buf[start:start + 4 * size] = slots.tobytes()
+  try:
+    MapBuffer.validate_buffer(bytes(buf))
+    assert False
+  except ValidationError:
+    pass
+
+@pytest.mark.parametrize("compress", (None, "gzip"))
+@pytest.mark.parametrize("hash_index", (False, True))
+def test_bloom_filter(compress, hash_index):
+  from mapbuffer.mapbuffer import BLOOM_FILTER, index_layout
+
+  for n in (0, 1, 3000):
+    data = {
+      random.randint(0, 2**40): bytes([
+        random.randint(0,255) for __ in range(random.randint(0,50))
+      ]) for _ in range(n)
+    }
+    mbuf = MapBuffer(
+      data, compress=compress, format_version=1,
+      hash_index=hash_index, bloom_filter=True
+    )
+    assert mbuf.index_flags & BLOOM_FILTER
+    layout = index_layout(1, n, mbuf.index_flags)
+    assert layout.filter % 64 == 0
+    assert len(mbuf.bloom_filter()) % 64 == 0
+    mbuf.validate()
+
+    assert np.all(mbuf.may_contain(list(data.keys())))
+    missing = [ 2**41 + i for i in range(10000) ]
+    false_positives = np.count_nonzero(mbuf.may_contain(missing))
+    assert false_positives < (500 if n else 1)
+    if n == 0:
+      continue
+
+    labels = list(data.keys())[:200] + missing[:200]
+    assert mbuf.getmany(labels) == [ data.get(lbl) for lbl in labels ]
+    assert all(( (lbl in mbuf) == (lbl in data) for lbl in labels ))
+    assert mbuf.todict() == data
+    assert MapBuffer(data, compress=compress).todict() == data
+
+  # the index isn't fetched when the filter rules out every label
+  requests = []
+  buf = mbuf.tobytes()
+  def fetch(start, end):
+    requests.append((start, end))
+    return buf[start:end]
+
+  remote = RemoteMapBuffer(fetch)
+  assert len(remote) == len(data)
+  assert len(requests) == 2
+  assert remote.getmany(missing[:100]) == [ None ] * 100
+  assert missing[0] not in remote
+  assert len(requests) == 2
+  label = labels[0]
+  assert remote[label] == data[label]
+  assert remote.getmany(labels) == [ data.get(lbl) for lbl in labels ]
+
+@pytest.mark.parametrize("compress", (None, "gzip"))
+@pytest.mark.parametrize("align", (8, 16, 64))
+def test_align(compress, align):
+  import io
+  from mapbuffer.mapbuffer import VALUE_PADDING
+
+  data = {
+    random.randint(0, 2**40): np.arange(
+      random.randint(0, 20), dtype=np.float32
+    ).tobytes() + b"x" * random.randint(0, 3)
+    for _ in range(500)
+  }
+  data[7] = np.arange(12, dtype=np.float64).tobytes()
+
+  mbuf = MapBuffer(data, compress=compress, format_version=1, align=align, checksums=True)
+  assert mbuf.index_flags & VALUE_PADDING
+  assert mbuf.align == align
+  mbuf.validate()
+  if not compress:
+    assert np.all(mbuf.offsets() % align == 0)
+    assert np.all(mbuf.lengths_array() == [ len(data[int(lbl)]) for lbl in mbuf.labels() ])
+  assert mbuf.todict() == data
+  assert mbuf.getmany(list(data.keys())) == list(data.values())
+
+  arr = mbuf.get_array(7, np.float64, shape=(3,4))
+  assert np.all(arr == np.arange(12, dtype=np.float64).reshape((3,4)))
+  if not compress:
+    assert not arr.flags.writeable
+  with pytest.raises(KeyError):
+    mbuf.get_array(2**41, np.uint8)
+
+  f = io.BytesIO()
+  with MapBufferWriter(
+    f, compress=compress, format_version=1, align=align, checksums=True
+  ) as writer:
+    writer.update(data)
+  if compress is None:
+    assert f.getvalue() == bytes(mbuf.tobytes())
+  assert MapBuffer(f.getvalue()).validate()
+  assert MapBuffer(f.getvalue()).todict() == data
+
+  subset = mbuf.subset([ 7 ] + list(data.keys())[:100])
+  assert subset.align == align
+  subset.validate()
+  assert subset[7] == data[7]
+
+  assert MapBuffer.merge([ mbuf ], align=0).todict() == data
+  assert MapBuffer(data, compress=compress).todict() == data
+
+  remote = RemoteMapBuffer(lambda start, end: mbuf.tobytes()[start:end])
+  labels = list(data.keys())[:50]
+  assert remote.getmany(labels) == [ data[lbl] for lbl in labels ]
+
+  with pytest.raises(ValueError):
+    MapBuffer(data, compress="gzip", format_version=1, align=align, block_size=256)
+  with pytest.raises(ValueError):
+    MapBuffer(data, format_version=1, align=12)
+  with pytest.raises(ValueError):
+    MapBuffer(data, align=align)
+
+def test_eytzinger_sort():
+  from mapbuffer.mapbuffer import eytzinger_sort
+
+  def reference(inpt, output, i = 0, k = 1):
+    if k <= len(inpt):
+      i = reference(inpt, output, i, 2 * k)
+      output[k - 1] = inpt[i]
+      i += 1
+      i = reference(inpt, output, i, 2 * k + 1)
+    return i
+
+  for n in list(range(0, 40)) + [ 1000, 1023, 1024, 1025 ]:
+    inpt = np.sort(np.random.randint(0, 2**40, size=(n,)).astype(np.uint64))
+    expected = np.zeros((n,), dtype=np.uint64)
+    reference(inpt, expected)
+
+    output = np.zeros((n,), dtype=np.uint64)
+    assert eytzinger_sort(inpt, output) == n
+    assert np.all(output == expected)
+
+@pytest.mark.parametrize("compress", (None, "gzip"))
+@pytest.mark.parametrize("format_version", (0, 1))
+def test_writer(compress, format_version):
+  import io
+
+  data = { 
+    random.randint(0, 1000000000): bytes([ 
+      random.randint(0,255) for __ in range(random.randint(0,50)) 
+    ]) for _ in range(1000) 
+  }
+
+  f = io.BytesIO()
+  with MapBufferWriter(f, compress=compress, format_version=format_version) as writer:
+    writer.update(( (label, value) for label, value in data.items() ))
+    assert len(writer) == len(data)
+
+  if compress is None:
+    expected = MapBuffer(data, format_version=format_version)
+    assert f.getvalue() == expected.tobytes()
+
+  mbuf = MapBuffer(f.getvalue())
+  assert mbuf.validate()
+  assert mbuf.todict() == data
+
+  f = io.BytesIO()
+  with MapBufferWriter(f) as writer:
+    pass
+  assert f.getvalue() == MapBuffer({}).tobytes()
+
+  writer = MapBufferWriter(io.BytesIO())
+  writer.add(1, b"a")
+  writer.add(1, b"b")
+  try:
+    writer.close()
+    assert False
+  except ValueError:
+    pass
+
+  # version 1 only options are rejected before any value is spilled
+  for option in ("checksums", "hash_index", "bloom_filter"):
+    with pytest.raises(ValueError):
+      MapBufferWriter(io.BytesIO(), format_version=0, **{ option: True })
+
+  spill = io.BytesIO(b"existing")
+  spill.seek(0, io.SEEK_END)
+  f = io.BytesIO()
+  with MapBufferWriter(f, compress=compress, spill=spill) as writer:
+    writer.update(data)
+  assert not spill.closed
+  assert spill.getvalue().startswith(b"existing")
+  assert MapBuffer(f.getvalue()).todict() == data
+
+@pytest.mark.parametrize("mode", ("mmap", "rb"))
+@pytest.mark.parametrize("compress", (None, "gzip"))
+@pytest.mark.parametrize("align", (0, 16))
+def test_open(tmp_path, mode, compress, align):
+  data = { 
+    random.randint(0, 1000000000): bytes([ 
+      random.randint(0,255) for __ in range(random.randint(0,50)) 
+    ]) for _ in range(1000) 
+  }
+  path = str(tmp_path / "data.mb")
+  options = { "format_version": 1, "align": align } if align else {}
+  with open(path, "wb") as f:
+    f.write(MapBuffer(data, compress=compress, **options).tobytes())
+
+  with MapBuffer.open(path, mode=mode, lock_index=(mode == "mmap")) as mbuf:
+    assert len(mbuf) == len(data)
+    labels = list(data.keys())[:100]
+    assert mbuf.getmany(labels) == [ data[label] for label in labels ]
+    for label in labels:
+      assert mbuf[label] == data[label]
+    assert mbuf.validate()
+
+    ordered = sorted(data)
+    assert list(mbuf.sorted_labels()) == ordered
+    assert list(mbuf.keys(sorted=True)) == ordered
+    assert list(mbuf.items(sorted=True, prefetch=64)) == [ (k, data[k]) for k in ordered ]
+    assert list(mbuf.items(sorted=True, parallel=2)) == [ (k, data[k]) for k in ordered ]
+
+  if mode == "mmap":
+    assert mbuf.buffer.closed
+
+  with open(path, "rb") as f:
+    mbuf = MapBuffer(f)
+    assert mbuf.todict() == data
+    mbuf.close()
+    assert mbuf.buffer.closed
+
+def test_default_format_version():
+  from mapbuffer import FORMAT_VERSION
+  assert FORMAT_VERSION == 0
+  mbuf = MapBuffer({ 1: b"a", 2: b"b" })
+  assert mbuf.format_version == 0
+  assert mbuf.tobytes()[7] == 0
+  assert MapBuffer.merge([ mbuf ]).format_version == 0
+  assert MapBuffer.merge([ mbuf, MapBuffer({ 3: b"c" }, format_version=1) ]).format_version == 1
+  with pytest.raises(ValueError):
+    MapBuffer({ 1: b"a" }, checksums=True)
+
+def test_header_parsed_once():
+  mbuf = MapBuffer({ 1: b"a", 2: b"b" }, compress="gzip", format_version=0)
+  assert len(mbuf) == 2
+  assert mbuf.compress == "gzip"
+  assert mbuf.format_version == 0
+
+  index = mbuf.index()
+  assert not index.flags.writeable # zero-copy view of the buffer
+  assert index is mbuf.index()
+
+  try:
+    MapBuffer(b"mapbufr")
+    assert False
+  except ValueError:
+    pass
+
+@pytest.mark.parametrize("compress", (None, "gzip", "br", "zstd", "lzma"))
+def test_parallel_compression(compress):
+  data = { 
+    random.randint(0, 1000000000): bytes([ 
+      random.randint(0,255) for __ in range(random.randint(0,50)) 
+    ]) for _ in range(1000) 
+  }
+  serial = MapBuffer(data, compress=compress)
+  threaded = MapBuffer(data, compress=compress, parallel=4)
+  assert serial.tobytes() == threaded.tobytes()
+  assert threaded.todict() == data
+
+  tobytesfn = lambda x: x[::-1]
+  threaded = MapBuffer(data, compress=compress, parallel=True, tobytesfn=tobytesfn)
+  assert threaded.todict() == { k: v[::-1] for k, v in data.items() }
+
+@pytest.mark.parametrize("compress", (None, "gzip", "zstd"))
+def test_parallel_decompression(compress):
+  data = { 
+    random.randint(0, 1000000000): bytes([ 
+      random.randint(0,255) for __ in range(random.randint(0,50)) 
+    ]) for _ in range(1000) 
+  }
+  mbuf = MapBuffer(data, compress=compress, frombytesfn=lambda x: x[::-1])
+  expected = { k: v[::-1] for k, v in data.items() }
+
+  assert mbuf.todict(parallel=4) == expected
+  assert list(mbuf.items(parallel=4)) == list(mbuf.items())
+  assert list(mbuf.values(parallel=True)) == list(mbuf.values())
+
+  labels = list(data.keys())[:200] + [ -1 % 2**64 ]
+  values = mbuf.getmany(labels, default=b"missing", parallel=4)
+  assert values == mbuf.getmany(labels, default=b"missing")
+  assert values[-1] == b"missing"
+
+@pytest.mark.parametrize("parallel", (1, 4))
+def test_zstd_dict(parallel):
+  import io
+
+  data = { 
+    random.randint(0, 1000000000): (
+      b"vertices:" + bytes([ random.randint(0,7) for __ in range(random.randint(0,200)) ])
+    ) for _ in range(2000) 
+  }
+  mbuf = MapBuffer(data, compress="zstd-dict", format_version=1, parallel=parallel)
+  assert mbuf.compress == "zstd-dict"
+  assert len(mbuf.dictionary()) > 0
+  assert mbuf.todict() == data
+  mbuf.validate()
+
+  reloaded = MapBuffer(mbuf.tobytes())
+  for label in list(data.keys())[:100]:
+    assert reloaded[label] == data[label]
+
+  try:
+    MapBuffer(data, compress="zstd-dict", format_version=0)
+    assert False
+  except ValueError:
+    pass
+
+  # too little data to train on falls back to an empty dictionary
+  small = { 1: b"a", 2: b"b" }
+  mbuf = MapBuffer(small, compress="zstd-dict", format_version=1)
+  assert mbuf.dictionary() == b""
+  assert mbuf.todict() == small
+
+  dictionary = reloaded.dictionary()
+  out = io.BytesIO()
+  with MapBufferWriter(
+    out, compress="zstd-dict", format_version=1, dictionary=dictionary
+  ) as writer:
+    writer.update(data)
+  assert MapBuffer(out.getvalue()).todict() == data
+
+@pytest.mark.parametrize("compress", ("gzip", "zstd", "zstd-dict"))
+@pytest.mark.parametrize("block_size", (1, 256, 4096))
+def test_block_compression(compress, block_size):
+  import io
+
+  data = { 
+    random.randint(0, 1000000000): bytes([ 
+      random.randint(0,7) for __ in range(random.randint(0,50)) 
+    ]) for _ in range(1000) 
+  }
+  mbuf = MapBuffer(
+    data, compress=compress, format_version=1, 
+    block_size=block_size, block_cache_size=4
+  )
+  assert mbuf.is_block_compressed()
+  mbuf.validate()
+
+  assert mbuf.todict() == data
+  assert mbuf.todict(parallel=4) == data
+  assert list(mbuf.keys()) == sorted(data.keys())
+  for label in random.sample(list(data.keys()), 100):
+    assert mbuf[label] == data[label]
+    assert bytes(mbuf.getview(label)) == data[label]
+  assert len(mbuf._blocks) <= 4
+
+  labels = list(data.keys())[:100] + [ -1 % 2**64 ]
+  assert mbuf.getmany(labels, parallel=4) == [ data.get(lbl) for lbl in labels ]
+
+  reloaded = MapBuffer(mbuf.tobytes())
+  assert reloaded.todict() == data
+
+  out = io.BytesIO()
+  with MapBufferWriter(
+    out, compress=compress, format_version=1, block_size=block_size, 
+    dictionary=reloaded.dictionary()
+  ) as writer:
+    writer.update(data)
+  written = MapBuffer(out.getvalue())
+  written.validate()
+  assert written.todict() == data
+
+  empty = MapBuffer({}, compress=compress, format_version=1, block_size=block_size)
+  empty.validate()
+  assert len(empty) == 0
+
+  try:
+    MapBuffer(data, compress=None, format_version=1, block_size=block_size)
+    assert False
+  except ValueError:
+    pass
+
+@pytest.mark.parametrize("compress", (None, "gzip"))
+@pytest.mark.parametrize("format_version", (0, 1))
+@pytest.mark.parametrize("block_size", (0, 512))
+def test_remote(compress, format_version, block_size):
+  from mapbuffer.remote import coalesce_ranges
+
+  assert coalesce_ranges([ (10,20), (0,5), (6,8), (30, None), (40,50) ], max_gap=1) == [
+    (0, 8, [1, 2]), (10, 20, [0]), (30, None, [3, 4])
+  ]
+
+  if block_size and (compress is None or format_version == 0):
+    return
+
+  data = { 
+    random.randint(0, 1000000000): bytes([ 
+      random.randint(0,255) for __ in range(random.randint(0,50)) 
+    ]) for _ in range(1000) 
+  }
+  buf = MapBuffer(
+    data, compress=compress, 
+    format_version=format_version, block_size=block_size
+  ).tobytes()
+
+  requests = []
+  def fetch(start, end):
+    requests.append((start, end))
+    return buf[start:end]
+
+  remote = RemoteMapBuffer(fetch, frombytesfn=lambda x: x[::-1], parallel=4)
+  assert len(remote) == len(data)
+  assert set(remote.keys()) == set(data.keys())
+  index_requests = len(requests)
+  assert index_requests <= 2
+
+  labels = list(data.keys())
+  random.shuffle(labels)
+  labels = labels[:100] + [ -1 % 2**64 ]
+  values = remote.getmany(labels, default=b"missing")
+  assert values[-1] == b"missing"
+  assert values[:-1] == [ data[lbl][::-1] for lbl in labels[:-1] ]
+  assert len(requests) - index_requests <= 100
+
+  label = labels[0]
+  assert remote[label] == data[label][::-1]
+  assert remote.get(-1 % 2**64) is None
+  assert label in remote
+
+  # everything in one request when gaps are allowed to be large
+  remote = RemoteMapBuffer(fetch, max_gap=len(buf))
+  del requests[:]
+  assert remote.getmany(list(data.keys())) == list(data.values())
+  assert len(requests) == 1
+
+@pytest.mark.parametrize("overlap", (False, True))
+def test_collection(tmp_path, overlap):
+  from mapbuffer import MapBufferCollection
+
+  shards = []
+  for j in range(6):
+    lo = j * 10000 - (5000 if overlap and j % 2 else 0)
+    n = 0 if j == 3 else 300
+    shards.append({
+      random.randint(lo, lo + 9999): bytes([
+        random.randint(0,255) for __ in range(random.randint(0,20))
+      ]) for _ in range(n)
+    })
+
+  paths = []
+  for j, data in enumerate(shards):
+    path = str(tmp_path / f"{j}.mb")
+    with open(path, "wb") as f:
+      f.write(MapBuffer(
+        data, compress=(None if j % 2 else "gzip"), 
+        format_version=1, bloom_filter=(j < 3)
+      ).tobytes())
+    paths.append(path)
+
+  expected = {}
+  for data in shards:
+    for label, value in data.items():
+      expected.setdefault(label, value)
+
+  collection = MapBufferCollection(paths, parallel=3, max_open=2)
+  assert len(collection) == len(shards)
+  labels = list(expected.keys())
+  random.shuffle(labels)
+  labels = labels[:500] + [ 60000, 123456789 ]
+  assert collection.getmany(labels) == [ expected.get(lbl) for lbl in labels ]
+  assert len(collection._open) <= 2
+  assert collection.route([ 123456789 ]) == []
+
+  routed = {}
+  for j, members in collection.route(labels):
+    for i in members:
+      routed.setdefault(labels[i], []).append(j)
+  for lbl in labels:
+    containing = [ j for j, data in enumerate(shards) if lbl in data ]
+    assert [ j for j in routed.get(lbl, []) if lbl in shards[j] ] == containing
+
+  label = labels[0]
+  assert collection[label] == expected[label]
+  assert label in collection
+  assert 123456789 not in collection
+  assert collection.get(123456789, b"x") == b"x"
+
+  directory = str(tmp_path / "directory.npz")
+  collection.save_directory(directory)
+  collection.close()
+
+  with MapBufferCollection.from_directory(directory, parallel=1) as loaded:
+    assert loaded.paths == paths
+    assert loaded.getmany(labels) == [ expected.get(lbl) for lbl in labels ]
+
+@pytest.mark.parametrize("compress", (None, "gzip"))
+@pytest.mark.parametrize("block_size", (0, 512))
+def test_checksums(compress, block_size):
+  import io
+  from mapbuffer import ChecksumError
+  import mapbufferaccel
+
+  assert mapbufferaccel.crc32c(b"123456789") == 0xe3069283
+  assert mapbufferaccel.crc32c(b"56789", mapbufferaccel.crc32c(b"1234")) == 0xe3069283
+
+  if block_size and not compress:
+    return
+
+  data = { 
+    random.randint(0, 1000000000): bytes([ 
+      random.randint(0,255) for __ in range(random.randint(1,50)) 
+    ]) for _ in range(1000) 
+  }
+  mbuf = MapBuffer(
+    data, compress=compress, format_version=1, 
+    block_size=block_size, checksums=True
+  )
+  assert mbuf.checksums() is not None
+  assert mbuf.validate()
+  assert MapBuffer(mbuf.tobytes(), verify=True).todict() == data
+
+  out = io.BytesIO()
+  with MapBufferWriter(
+    out, compress=compress, format_version=1, 
+    block_size=block_size, checksums=True
+  ) as writer:
+    writer.update(data)
+  written = MapBuffer(out.getvalue(), verify=True)
+  assert np.all(np.sort(written.checksums()) == np.sort(mbuf.checksums()))
+  assert written.todict() == data
+  if compress is None:
+    assert out.getvalue() == mbuf.tobytes()
+
+  if block_size:
+    return
+
+  # flip a bit in the last value
+  corrupt = bytearray(mbuf.tobytes())
+  corrupt[-1] ^= 0x01
+  corrupt = bytes(corrupt)
+  with pytest.raises(ChecksumError):
+    MapBuffer.validate_buffer(corrupt)
+
+  last_label = mbuf.labels()[-1]
+  MapBuffer(corrupt).getrawindex(len(data) - 1) # unverified reads pass
+  with pytest.raises(ChecksumError):
+    MapBuffer(corrupt, verify=True)[last_label]
+  with pytest.raises(ChecksumError):
+    MapBuffer(corrupt, verify=True).getview(last_label)
+
+def test_validate_eytzinger_order():
+  data = { i: bytes([ i ]) for i in range(1, 20) }
+  mbuf = MapBuffer(data, format_version=1, compact_index=False)
+  assert mbuf.validate()
+
+  buf = bytearray(mbuf.tobytes())
+  labels = np.frombuffer(buf, dtype=np.uint64, count=len(data), offset=72)
+  labels[0], labels[1] = labels[1], labels[0]
+  with pytest.raises(ValidationError):
+    MapBuffer.validate_buffer(bytes(buf))
+
+@pytest.mark.parametrize("compress", (None, "gzip", "zstd"))
+def test_merge(compress):
+  def random_data(lo, hi, n):
+    return { 
+      random.randint(lo, hi): bytes([ 
+        random.randint(0,255) for __ in range(random.randint(0,50)) 
+      ]) for _ in range(n) 
+    }
+
+  a = random_data(0, 10000, 300)
+  b = random_data(20000, 30000, 300)
+  c = random_data(40000, 50000, 300)
+  mbs = [ 
+    MapBuffer(x, compress=compress, format_version=1, checksums=True) 
+    for x in (a, b, c) 
+  ]
+  merged = MapBuffer.merge(mbs)
+  assert merged.format_version == 1
+  assert merged.compress == compress
+  assert merged.checksums() is not None
+  merged.validate()
+  assert merged.todict() == { **a, **b, **c }
+
+  # raw copies are byte identical to building from scratch
+  assert merged.tobytes() == MapBuffer(
+    { **a, **b, **c }, compress=compress, format_version=1, checksums=True
+  ).tobytes()
+
+  x = { 1: b"x1", 2: b"x2", 3: b"x3" }
+  y = { 2: b"y2", 3: b"y3", 4: b"y4" }
+  mx, my = MapBuffer(x, compress=compress), MapBuffer(y, compress=compress)
+
+  with pytest.raises(ValueError):
+    MapBuffer.merge([ mx, my ])
+
+  assert MapBuffer.merge([ mx, my ], on_conflict="first").todict() == { **y, **x }
+  assert MapBuffer.merge([ mx, my ], on_conflict="last").todict() == { **x, **y }
+  combined = MapBuffer.merge([ mx, my ], on_conflict=lambda label, values: b"+".join(values))
+  assert combined.todict() == { 1: b"x1", 2: b"x2+y2", 3: b"x3+y3", 4: b"y4" }
+  combined.validate()
+
+  # different compression is transcoded
+  mixed = MapBuffer.merge([ mx, MapBuffer(y, compress="br") ], on_conflict="last", compress="lzma")
+  assert mixed.compress == "lzma"
+  assert mixed.todict() == { **x, **y }
+
+  assert len(MapBuffer.merge([])) == 0
+
+@pytest.mark.parametrize("compress", (None, "gzip"))
+def test_subset_and_range(compress):
+  import io
+  data = { 
+    random.randint(0, 100000): bytes([ 
+      random.randint(0,255) for __ in range(random.randint(0,50)) 
+    ]) for _ in range(1000) 
+  }
+  mb = MapBuffer(data, compress=compress, format_version=1, checksums=True)
+  ordered = sorted(data)
+
+  assert list(mb.ordered_keys()) == ordered
+  assert list(mb.ordered_keys(chunk_size=7)) == ordered
+  assert list(mb.ordered_keys(lo=50000, hi=60000)) == [ k for k in ordered if 50000 <= k < 60000 ]
+
+  picked = ordered[::3] + [ 100001, 100002 ]
+  sub = mb.subset(picked)
+  sub.validate()
+  assert sub.compress == compress
+  assert sub.checksums() is not None
+  assert sub.todict() == { k: data[k] for k in ordered[::3] }
+  assert sub.tobytes() == MapBuffer(
+    { k: data[k] for k in ordered[::3] }, 
+    compress=compress, format_version=1, checksums=True
+  ).tobytes()
+
+  sliced = mb.range(20000, 30000)
+  assert sliced.todict() == { k: v for k, v in data.items() if 20000 <= k < 30000 }
+  assert mb.range(hi=min(ordered)).todict() == {}
+  assert len(mb.range()) == len(mb)
+
+  f = io.BytesIO()
+  assert mb.range(lo=90000, file=f) is None
+  assert MapBuffer(f.getvalue()).todict() == { k: v for k, v in data.items() if k >= 90000 }
+
+  blocked = MapBuffer(data, compress="gzip", format_version=1, block_size=512)
+  assert blocked.subset(picked).todict() == { k: data[k] for k in ordered[::3] }
+
+@pytest.mark.parametrize("block_size", (0, 256))
+def test_keys_array(block_size):
+  data = { 
+    random.randint(0, 100000): bytes([ 
+      random.randint(0,255) for __ in range(random.randint(0,50)) 
+    ]) for _ in range(500) 
+  }
+  mb = MapBuffer(
+    data, compress=("gzip" if block_size else None), 
+    format_version=1, block_size=block_size
+  )
+
+  keys = mb.keys_array()
+  assert not keys.flags.writeable
+  assert sorted(keys.tolist()) == sorted(data)
+
+  lengths = mb.lengths_array()
+  assert { int(k): int(n) for k, n in zip(keys, lengths) } == { k: len(v) for k, v in data.items() }
+
+  queries = np.array([ 100001, *list(data)[:10], 100002 ], dtype=np.uint64)
+  assert mb.isin(queries).tolist() == [ False ] + [ True ] * 10 + [ False ]
+
+@pytest.mark.parametrize("compress", (None, "gzip"))
+def test_buffer_protocol(compress):
+  data = { 
+    random.randint(0, 100000): bytes([ 
+      random.randint(0,255) for __ in range(random.randint(0,50)) 
+    ]) for _ in range(300) 
+  }
+  binary = MapBuffer(data, compress=compress, format_version=1, checksums=True).tobytes()
+  container = bytearray(b"x" * 100) + binary + bytearray(b"y" * 17)
+
+  embedded = MapBuffer(container, offset=100, length=len(binary))
+  assert len(embedded.tobytes()) == len(binary)
+  assert embedded.validate()
+  assert embedded.todict() == data
+  label = next(iter(data))
+  assert embedded[label] == data[label]
+  assert isinstance(embedded.getmany([ label ])[0], bytes)
+
+  # views reference the container rather than a copy
+  view = MapBuffer(memoryview(container)[100:100 + len(binary)])
+  assert view.validate()
+  assert view.todict() == data
+
+  array = np.frombuffer(binary + b"\0" * (-len(binary) % 8), dtype=np.uint64)
+  arr = MapBuffer(array, length=len(binary))
+  assert arr.todict() == data
+
+  assert MapBuffer.validate_buffer(bytearray(binary))
+  with pytest.raises(ValidationError):
+    MapBuffer.validate_buffer(memoryview(container)[:len(binary)])
+
+def test_embedded_file_close(tmp_path):
+  data = { 1: b"one", 2: b"two", 3: b"three" }
+  binary = MapBuffer(data).tobytes()
+  path = tmp_path / "embedded.bin"
+  path.write_bytes(b"x" * 100 + binary + b"y" * 17)
+
+  with open(path, "rb") as f:
+    mbuf = MapBuffer(f, offset=100, length=len(binary))
+  assert mbuf.todict() == data
+  assert mbuf[2] == b"two"
+  mbuf.close()
+  assert mbuf._mmap.closed
+
+def test_stats():
+  import mapbuffer
+  data = { i: bytes([ i % 256 ]) * (i % 37) for i in range(200) }
+
+  plain = MapBuffer(data, compress="gzip")
+  assert plain.stats() is None
+
+  mapbuffer.reset_global_stats()
+  mb = MapBuffer(data, compress="gzip", stats=True)
+  mb[5]
+  mb.get(100000)
+  mb.getmany([ 1, 2, 3, 100001 ])
+
+  stats = mb.stats()
+  assert stats["lookups"] == 6
+  assert stats["hits"] == 4
+  assert stats["misses"] == 2
+  assert stats["bytes_read"] > 0
+  assert stats["decompress"]["gzip"]["calls"] == 4
+  assert stats["decompress"]["gzip"]["bytes_out"] == sum(( len(data[i]) for i in (1, 2, 3, 5) ))
+
+  assert mapbuffer.global_stats()["lookups"] == 6
+
+  mb.reset_stats()
+  assert mb.stats()["lookups"] == 0
+
+  mapbuffer.enable_stats()
+  try:
+    assert MapBuffer(data).stats() is not None
+  finally:
+    mapbuffer.enable_stats(False)
+
+@pytest.mark.parametrize("format_version", (0, 1))
+@pytest.mark.parametrize("compact_index", (False, True))
+def test_search_kernels(format_version, compact_index):
+  import mapbufferaccel
+
+  assert mapbufferaccel.SEARCH_KERNELS[0] == "scalar"
+  assert mapbufferaccel.search_kernel() == mapbufferaccel.SEARCH_KERNELS[-1]
+  with pytest.raises(ValueError):
+    mapbufferaccel.set_search_kernel("unknown")
+
+  default = mapbufferaccel.search_kernel()
+  try:
+    for n in (0, 1, 15, 16, 17, 1000, 3000):
+      labels = np.unique(np.random.randint(0, 2**31, size=n, dtype=np.uint64))
+      if not compact_index and n > 2:
+        labels[-1] = 2**64 - 1
+        labels[-2] = 2**63
+      mbuf = MapBuffer(
+        { int(lbl): b"" for lbl in labels }, 
+        format_version=format_version, compact_index=compact_index
+      )
+      queries = np.concatenate([ 
+        labels, np.random.randint(0, 2**31, size=100, dtype=np.uint64),
+        np.array([ 0, 2**63 - 1, 2**63, 2**64 - 1 ], dtype=np.uint64),
+      ])
+      expected = None
+      for kernel in mapbufferaccel.SEARCH_KERNELS:
+        mapbufferaccel.set_search_kernel(kernel)
+        assert mapbufferaccel.search_kernel() == kernel
+        positions = mbuf.find_index_positions(queries)
+        if expected is None:
+          expected = positions
+          found = positions >= 0
+          assert np.all(np.isin(queries[found], labels))
+          assert not np.any(np.isin(queries[~found], labels))
+          assert np.all(mbuf.labels()[positions[found]] == queries[found])
+        assert np.all(positions == expected)
+  finally:
+    mapbufferaccel.set_search_kernel(default)
+
+@pytest.mark.parametrize("compress", (None, "gzip"))
+def test_unrepresentable_labels(compress):
+  import mapbufferaccel
+  data = { 5: b"five", 2**64 - 1: b"max" }
+  mb = MapBuffer(data, compress=compress)
+  binary = mb.tobytes()
+  assert mapbufferaccel.find_index_position(binary, 5) >= 0
+  for label in (2**64 + 5, -(2**64) + 5, -1, 2**128):
+    assert mapbufferaccel.find_index_position(binary, label) == -1
+    assert mapbufferaccel.getvalue(binary, label) is None
+    assert mb.getview(label) is None
+    assert mb.find_index_position(label) is None
+    assert label not in mb
+    assert mb.get(label) is None
+    with pytest.raises(KeyError):
+      mb[label]
+
+def test_native_view():
+  import mapbufferaccel
+  data = { 1: b"a", 10: b"bb", 2 ** 40: b"", 7: b"ccc" }
+  view = mapbufferaccel.MapBufferView(MapBuffer(data).tobytes())
+  assert len(view) == len(data)
+  for label, value in data.items():
+    assert view[label] == value
+    assert view[np.uint64(label)] == value
+    assert label in view
+  assert 5 not in view
+  assert -1 not in view
+  assert view.get(5) is None
+  assert view.get(5, b"x") == b"x"
+  with pytest.raises(KeyError):
+    view[5]
+
+  mb = MapBuffer(data)
+  assert mb[10] == b"bb"
+  assert mb.get(5, b"x") == b"x"
+  assert 7 in mb and 8 not in mb
+  with pytest.raises(KeyError):
+    mb[5]
+
+  # malformed buffers still construct and fail validation
+  with pytest.raises(ValueError):
+    mapbufferaccel.MapBufferView(b"mapbufr\x09none\x00\x00\x00\x00")
+  with pytest.raises(ValueError):
+    mapbufferaccel.MapBufferView(MapBuffer(data, compress="gzip").tobytes())
+
+  view.__init__(MapBuffer({ 3: b"d" }).tobytes())
+  assert len(view) == 1 and view[3] == b"d"
+
+@pytest.mark.parametrize("compress", ("gzip", "zstd", "zstd-dict"))
+def test_native_decompression(compress):
+  import mapbufferaccel
+  data = { 
+    random.randint(0, 100000): bytes([ random.randint(0,3) ]) * random.randint(0, 500)
+    for _ in range(500) 
+  }
+  mb = MapBuffer(data, compress=compress, format_version=1)
+  labels = list(data.keys()) + [ 100001 ]
+  expected = [ data.get(label, b"missing") for label in labels ]
+  assert mb.getmany(labels, default=b"missing") == expected
+  assert mb.getmany(labels, default=b"missing", parallel=4) == expected
+
+  native = mapbufferaccel.decompress_values(
+    mb.tobytes(), np.array(labels, dtype=np.uint64), mb.dictionary(), 2
+  )
+  if compress in mapbufferaccel.NATIVE_CODECS and (compress != "zstd-dict" or mb.dictionary()):
+    assert native == [ data.get(label) for label in labels ]
+  else:
+    assert native is None
+
+def test_native_decompression_size_bound():
+  import gzip
+  import mapbufferaccel
+
+  # a gzip trailer claiming 2 GiB for a few bytes of input
+  # isn't allocated natively
+  value = bytearray(gzip.compress(b"abc"))
+  value[-4:] = (2 ** 31).to_bytes(4, "little")
+  mb = MapBuffer({ 1: bytes(value) })
+  binary = bytearray(mb.tobytes())
+  binary[8:12] = b"gzip"
+  labels = np.array([ 1 ], dtype=np.uint64)
+  assert mapbufferaccel.decompress_values(bytes(binary), labels, b"", 1) is None
+
+def test_threaded_readers():
+  from concurrent.futures import ThreadPoolExecutor
+  data = { 
+    random.randint(0, 1000000): bytes([ random.randint(0,255) ]) * random.randint(0, 20) 
+    for _ in range(5000) 
+  }
+  mb = MapBuffer(data)
+  labels = np.array(list(data.keys()), dtype=np.uint64)
+
+  def read(seed):
+    rng = np.random.default_rng(seed)
+    queries = rng.choice(labels, size=1000)
+    assert mb.getmany(queries) == [ data[int(label)] for label in queries ]
+    assert np.all(mb.find_index_positions(queries) >= 0)
+    return True
+
+  with ThreadPoolExecutor(max_workers=4) as executor:
+    assert all(executor.map(read, range(16)))
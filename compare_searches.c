@@ -56,6 +56,194 @@ int binary_search(int* array, int n, int x) {
     return array[l];
 }
 
+// mapbuffer format version 0 index layout: 
+// [ label, pos, label, pos, ... ] as uint64 with
+// the labels in eytzinger order (0-based)
+
+uint64_t mb_search(uint64_t* array, uint64_t n, uint64_t x) {
+    uint64_t k = 1;
+    while (k <= n) {
+        k = 2 * k + (array[(k - 1) << 1] < x);
+    }
+    k >>= __builtin_ffsll(~k);
+    return k;
+}
+
+// Each node is 16 bytes, so the 8 descendants three levels
+// below node k are 128 contiguous bytes (two cache lines)
+// starting at node 8k. When the index begins 16 bytes into
+// a 64 byte aligned buffer (as it does in a mapbuffer) they
+// are exactly two aligned cache lines.
+uint64_t mb_search_prefetch(uint64_t* array, uint64_t n, uint64_t x) {
+    uint64_t k = 1;
+    while (k <= n) {
+        uint64_t* ahead = array + ((8 * k - 1) << 1);
+        __builtin_prefetch(ahead);
+        __builtin_prefetch(ahead + 8);
+        k = 2 * k + (array[(k - 1) << 1] < x);
+    }
+    k >>= __builtin_ffsll(~k);
+    return k;
+}
+
+// Naive prefetch of array + k * block_size as in eytzinger_search
+// which does not line up with the 16 byte stride.
+uint64_t mb_search_prefetch_naive(uint64_t* array, uint64_t n, uint64_t x) {
+    uint64_t k = 1;
+    while (k <= n) {
+        __builtin_prefetch(array + k * 8);
+        k = 2 * k + (array[(k - 1) << 1] < x);
+    }
+    k >>= __builtin_ffsll(~k);
+    return k;
+}
+
+// mapbuffer format version 1 stores the eytzinger 
+// ordered labels contiguously starting at byte 72 so
+// nodes 8k..8k+7 are a single aligned cache line.
+
+uint64_t mb1_search(uint64_t* labels, uint64_t n, uint64_t x) {
+    uint64_t k = 1;
+    while (k <= n) {
+        k = 2 * k + (labels[k - 1] < x);
+    }
+    k >>= __builtin_ffsll(~k);
+    return k;
+}
+
+uint64_t mb1_search_prefetch(uint64_t* labels, uint64_t n, uint64_t x) {
+    uint64_t k = 1;
+    while (k <= n) {
+        __builtin_prefetch(labels + 8 * k - 1);
+        k = 2 * k + (labels[k - 1] < x);
+    }
+    k >>= __builtin_ffsll(~k);
+    return k;
+}
+
+// 16 searches advanced in lockstep as in 
+// mapbufferaccel's eytzinger_binary_search_many
+void mb_search_many(uint64_t* array, uint64_t n, uint64_t* x, uint64_t* out, int prefetch) {
+    uint64_t k[16];
+    for (int j = 0; j < 16; j++) {
+        k[j] = 1;
+    }
+    uint64_t full = 1;
+    while (2 * full + 1 <= n) {
+        full = 2 * full + 1;
+    }
+    for (uint64_t level = 1; level <= full; level = 2 * level + 1) {
+        if (prefetch) {
+            for (int j = 0; j < 16; j++) {
+                uint64_t* ahead = array + ((8 * k[j] - 1) << 1);
+                __builtin_prefetch(ahead);
+                __builtin_prefetch(ahead + 8);
+            }
+        }
+        for (int j = 0; j < 16; j++) {
+            k[j] = 2 * k[j] + (array[(k[j] - 1) << 1] < x[j]);
+        }
+    }
+    for (int j = 0; j < 16; j++) {
+        while (k[j] <= n) {
+            k[j] = 2 * k[j] + (array[(k[j] - 1) << 1] < x[j]);
+        }
+        out[j] = k[j] >> __builtin_ffsll(~k[j]);
+    }
+}
+
+double mb_time_many(int prefetch, uint64_t* index, uint64_t n, uint64_t* queries, int num_queries) {
+    uint64_t out[16];
+    volatile uint64_t x = 0;
+    clock_t start = clock();
+    for (int i = 0; i + 16 <= num_queries; i += 16) {
+        mb_search_many(index, n, queries + i, out, prefetch);
+        x += out[0];
+    }
+    clock_t end = clock();
+    return (double)(end - start) / (double)(CLOCKS_PER_SEC) * 1e9 / (double)num_queries;
+}
+
+int compare_u64(const void* a, const void* b) {
+    uint64_t int_a = *((uint64_t*)a);
+    uint64_t int_b = *((uint64_t*)b);
+    return (int_a > int_b) - (int_a < int_b);
+}
+
+uint64_t mb_eytzinger_helper(uint64_t *input, uint64_t *index, uint64_t n, uint64_t i, uint64_t k) {
+    if (k <= n) {
+        i = mb_eytzinger_helper(input, index, n, i, 2 * k);
+        index[(k - 1) << 1] = input[i];
+        index[((k - 1) << 1) + 1] = i;
+        i++;
+        i = mb_eytzinger_helper(input, index, n, i, 2 * k + 1);
+    }
+    return i;
+}
+
+double mb_time(uint64_t (*fn)(uint64_t*, uint64_t, uint64_t), uint64_t* index, uint64_t n, uint64_t* queries, int num_queries) {
+    volatile uint64_t x = 0;
+    clock_t start = clock();
+    for (int i = 0; i < num_queries; i++) {
+        x += fn(index, n, queries[i]);
+    }
+    clock_t end = clock();
+    return (double)(end - start) / (double)(CLOCKS_PER_SEC) * 1e9 / (double)num_queries;
+}
+
+void mapbuffer_layout_benchmark() {
+    const int num_queries = 1000000;
+    uint64_t* queries = (uint64_t*)calloc(num_queries, sizeof(uint64_t));
+
+    printf("\nmapbuffer index layouts (ns/lookup, %d random hits)\n", num_queries);
+    printf("N\tv0 index MiB\tv0 plain\tv0 prefetch\tv0 naive prefetch\tv0 batched\tv0 batched prefetch\tv1 plain\tv1 prefetch\n");
+
+    for (int p = 10; p <= 24; p += 2) {
+        uint64_t n = (uint64_t)1 << p;
+        uint64_t* input = (uint64_t*)calloc(n, sizeof(uint64_t));
+        for (uint64_t i = 0; i < n; i++) {
+            input[i] = ((uint64_t)random() << 31) ^ (uint64_t)random();
+        }
+        qsort(input, n, sizeof(uint64_t), compare_u64);
+
+        // mimic the 16 byte header in front of the index
+        uint64_t* buffer = (uint64_t*)aligned_alloc(64, (2 * n + 8) * sizeof(uint64_t));
+        uint64_t* index = buffer + 2;
+        mb_eytzinger_helper(input, index, n, 0, 1);
+
+        // v1: 64 byte header, one padding element, then labels
+        uint64_t* buffer1 = (uint64_t*)aligned_alloc(64, (n + 16) * sizeof(uint64_t));
+        uint64_t* labels1 = buffer1 + 9;
+        for (uint64_t i = 0; i < n; i++) {
+            labels1[i] = index[i << 1];
+        }
+
+        for (int i = 0; i < num_queries; i++) {
+            queries[i] = input[random() % n];
+        }
+
+        double plain = mb_time(mb_search, index, n, queries, num_queries);
+        double prefetch = mb_time(mb_search_prefetch, index, n, queries, num_queries);
+        double naive = mb_time(mb_search_prefetch_naive, index, n, queries, num_queries);
+        double batched = mb_time_many(0, index, n, queries, num_queries);
+        double batched_prefetch = mb_time_many(1, index, n, queries, num_queries);
+        double plain1 = mb_time(mb1_search, labels1, n, queries, num_queries);
+        double prefetch1 = mb_time(mb1_search_prefetch, labels1, n, queries, num_queries);
+
+        printf("%llu\t%.2f\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\n", 
+            (unsigned long long)n, (double)(n * 16) / 1024. / 1024.,
+            plain, prefetch, naive, batched, batched_prefetch,
+            plain1, prefetch1
+        );
+
+        free(buffer1);
+        free(buffer);
+        free(input);
+    }
+
+    free(queries);
+}
+
 int main() {
 	const int n = 1 << 20; // ~1e6
 	alignas(64) int *input = (int*)calloc(n, sizeof(int));
@@ -101,5 +289,7 @@ int main() {
 	free(input);
 	free(output);
 
+	mapbuffer_layout_benchmark();
+
 	return 0;
 }
\ No newline at end of file
@@ -28,4 +28,10 @@ Simple Example:
 """
 
 from .mapbuffer import MapBuffer, HEADER_LENGTH, MAGIC_NUMBERS, FORMAT_VERSION
-from .exceptions import *
\ No newline at end of file
+from .writer import MapBufferWriter
+from .remote import RemoteMapBuffer
+from .collection import MapBufferCollection
+from .exceptions import *
+from .stats import (
+  enable as enable_stats, global_stats, reset_global_stats
+)
@@ -0,0 +1,333 @@
+from collections import OrderedDict
+from concurrent.futures import ThreadPoolExecutor
+import contextlib
+import threading
+
+import numpy as np
+
+import mapbufferaccel
+
+from .lib import normalize_parallel
+from .mapbuffer import MapBuffer
+
+# marks labels a shard doesn't contain in getmany results
+_MISSING = object()
+
+class MapBufferCollection:
+  """
+  Reads many MapBuffer files (shards) as a single map. A
+  directory records the label range of every shard and its
+  Bloom filter (if it has one) so that each batch of labels
+  is only searched in the shards that may contain them. The
+  relevant shards are searched in parallel and at most
+  max_open of them are kept open (mmapped, along with their
+  parsed index arrays) in an LRU cache.
+
+  When shards overlap, a label is read from the first shard
+  in paths that contains it.
+
+  Example:
+
+    collection = MapBufferCollection(glob.glob("shards/*.mb"))
+    collection.save_directory("shards/directory.npz")
+    ...
+    collection = MapBufferCollection.from_directory("shards/directory.npz")
+    fragments = collection.getmany(labels)
+  """
+  __slots__ = (
+    "paths", "lo", "hi", "sizes", "filters",
+    "parallel", "max_open", "open_kwargs",
+    "_order", "_disjoint", "_reach", "_open", "_in_use", "_lock",
+  )
+  def __init__(
+    self, paths, parallel=8, max_open=64,
+    frombytesfn=None, block_cache_size=16, verify=False,
+    directory=None
+  ):
+    """
+    paths: MapBuffer file paths, one per shard
+    parallel: number of shards searched at once (True for
+      one per core). Also used to build the directory.
+    max_open: number of shards kept open between calls
+    frombytesfn, block_cache_size, verify: see MapBuffer.open
+    directory: (lo, hi, sizes, filters) as produced by
+      build_directory. Built by opening every shard if None.
+    """
+    self.paths = [ str(path) for path in paths ]
+    self.parallel = parallel
+    self.max_open = max(int(max_open), 1)
+    self.open_kwargs = {
+      "frombytesfn": frombytesfn,
+      "block_cache_size": block_cache_size,
+      "verify": verify,
+    }
+    self._open = OrderedDict()
+    self._in_use = {}
+    self._lock = threading.Lock()
+
+    if directory is None:
+      directory = build_directory(self.paths, parallel=parallel)
+    lo, hi, sizes, filters = directory
+    if not (len(lo) == len(hi) == len(sizes) == len(filters) == len(self.paths)):
+      raise ValueError(f"The directory doesn't describe {len(self.paths)} shards.")
+
+    self.lo = np.asarray(lo, dtype=np.uint64)
+    self.hi = np.asarray(hi, dtype=np.uint64)
+    self.sizes = np.asarray(sizes, dtype=np.uint64)
+    self.filters = list(filters)
+
+    # non-empty shards ordered by their lowest label
+    nonempty = np.flatnonzero(self.sizes > 0)
+    self._order = nonempty[np.argsort(self.lo[nonempty], kind="stable")]
+    ordered_lo = self.lo[self._order]
+    ordered_hi = self.hi[self._order]
+    self._disjoint = bool(np.all(ordered_lo[1:] > ordered_hi[:-1]))
+    # highest label of the shards up to each rank in _order
+    self._reach = np.maximum.accumulate(ordered_hi)
+
+  @classmethod
+  def from_directory(cls, path, **kwargs):
+    """Create a collection from a directory written by save_directory."""
+    with np.load(path) as npz:
+      paths = [ str(p) for p in npz["paths"] ]
+      starts = npz["filter_starts"]
+      bits = npz["filters"]
+      filters = [
+        (bits[start:end].tobytes() if end > start else None)
+        for start, end in zip(starts[:-1], starts[1:])
+      ]
+      directory = (npz["lo"], npz["hi"], npz["sizes"], filters)
+    return cls(paths, directory=directory, **kwargs)
+
+  def save_directory(self, path):
+    """Write the paths and directory to an .npz file."""
+    lengths = [ (0 if f is None else len(f)) for f in self.filters ]
+    starts = np.zeros((len(lengths) + 1,), dtype=np.int64)
+    np.cumsum(lengths, out=starts[1:])
+    bits = np.frombuffer(
+      b"".join(( f for f in self.filters if f is not None )), dtype=np.uint8
+    )
+    np.savez(
+      path, paths=np.array(self.paths, dtype=str),
+      lo=self.lo, hi=self.hi, sizes=self.sizes,
+      filter_starts=starts, filters=bits,
+    )
+
+  def __len__(self):
+    """Returns the number of shards."""
+    return len(self.paths)
+
+  def __enter__(self):
+    return self
+
+  def __exit__(self, exc_type, exc_value, traceback):
+    self.close()
+
+  def close(self):
+    """Close every open shard that isn't in use."""
+    with self._lock:
+      for j in list(self._open.keys()):
+        if not self._in_use.get(j, 0):
+          self._open.pop(j).close()
+
+  def route(self, labels):
+    """
+    Find the shards that may contain each label from the
+    directory alone (without opening any shard).
+
+    Returns: [ (shard index, positions in labels), ... ] in
+      ascending shard order.
+    """
+    labels = np.ascontiguousarray(labels, dtype=np.uint64).reshape(-1)
+    candidates = []
+    if len(labels) == 0 or len(self._order) == 0:
+      return candidates
+
+    # the shards whose range may hold a label are the ranks in
+    # [start, end): end is the first shard starting above it and
+    # start the first whose running highest label reaches it
+    ordered_lo = self.lo[self._order]
+    end = np.searchsorted(ordered_lo, labels, side="right").astype(np.int64)
+    if self._disjoint:
+      start = np.maximum(end - 1, 0)
+    else:
+      start = np.searchsorted(self._reach, labels, side="left").astype(np.int64)
+    counts = np.maximum(end - start, 0)
+
+    members = np.repeat(np.arange(len(labels)), counts)
+    firsts = np.cumsum(counts) - counts
+    ranks = np.repeat(start, counts) + (np.arange(len(members)) - np.repeat(firsts, counts))
+    shards = self._order[ranks]
+    inside = labels[members] <= self.hi[shards]
+    members = members[inside]
+    shards = shards[inside]
+
+    grouping = np.argsort(shards, kind="stable")
+    members = members[grouping]
+    shards = shards[grouping]
+    splits = np.flatnonzero(shards[1:] != shards[:-1]) + 1
+    for group in np.split(np.arange(len(shards)), splits):
+      if len(group):
+        candidates.append((int(shards[group[0]]), members[group]))
+
+    routes = []
+    for j, members in candidates:
+      bloom = self.filters[j]
+      if bloom is not None:
+        passed = np.zeros((len(members),), dtype=np.uint8)
+        mapbufferaccel.bloom_filter_contains(
+          bloom, np.ascontiguousarray(labels[members]), passed
+        )
+        members = members[passed.view(bool)]
+      if len(members):
+        routes.append((j, members))
+    return routes
+
+  @contextlib.contextmanager
+  def shard(self, j):
+    """
+    Open shard j (or reuse it from the cache) for the duration
+    of a with block. In use shards are never evicted.
+    """
+    with self._lock:
+      mb = self._acquire(j)
+
+    if mb is None:
+      # opened without the lock so that lookups in other shards
+      # proceed, another thread may have opened it meanwhile
+      opened = MapBuffer.open(self.paths[j], **self.open_kwargs)
+      with self._lock:
+        if j not in self._open:
+          self._open[j] = opened
+        mb = self._acquire(j)
+      if mb is not opened:
+        opened.close()
+
+    try:
+      yield mb
+    finally:
+      with self._lock:
+        self._in_use[j] -= 1
+        if not self._in_use[j]:
+          del self._in_use[j]
+        self._evict()
+
+  def _acquire(self, j):
+    """Mark open shard j in use. Returns it or None if closed."""
+    mb = self._open.get(j, None)
+    if mb is None:
+      return None
+    self._open.move_to_end(j)
+    self._in_use[j] = self._in_use.get(j, 0) + 1
+    self._evict()
+    return mb
+
+  def _evict(self):
+    """Close the least recently used idle shards beyond max_open."""
+    excess = len(self._open) - self.max_open
+    if excess <= 0:
+      return
+    for j in list(self._open.keys()):
+      if excess <= 0:
+        break
+      if not self._in_use.get(j, 0):
+        self._open.pop(j).close()
+        excess -= 1
+
+  def getmany(self, labels, default=None, parallel=None):
+    """
+    Get the values for many labels at once. Returns a list
+    aligned with labels with default substituted for missing
+    labels. Only the shards the directory routes labels to
+    are opened, up to parallel of them at once.
+    """
+    parallel = normalize_parallel(
+      self.parallel if parallel is None else parallel
+    )
+    labels = np.ascontiguousarray(labels, dtype=np.uint64).reshape(-1)
+    routes = self.route(labels)
+
+    def fetch(route):
+      j, members = route
+      with self.shard(j) as mb:
+        return mb.getmany(labels[members], default=_MISSING)
+
+    if parallel == 1 or len(routes) <= 1:
+      responses = [ fetch(route) for route in routes ]
+    else:
+      with ThreadPoolExecutor(max_workers=min(parallel, len(routes))) as executor:
+        responses = list(executor.map(fetch, routes))
+
+    results = [ _MISSING ] * len(labels)
+    for (j, members), values in zip(routes, responses):
+      for i, value in zip(members, values):
+        if value is not _MISSING and results[i] is _MISSING:
+          results[i] = value
+
+    return [
+      (default if value is _MISSING else value)
+      for value in results
+    ]
+
+  def get(self, label, default=None):
+    return self.getmany([ label ], default=default)[0]
+
+  def __getitem__(self, label):
+    value = self.getmany([ label ], default=_MISSING)[0]
+    if value is _MISSING:
+      raise KeyError("{} was not found.".format(label))
+    return value
+
+  def __contains__(self, label):
+    for j, _ in self.route([ label ]):
+      with self.shard(j) as mb:
+        if label in mb:
+          return True
+    return False
+
+def label_bounds(mb):
+  """
+  Returns the (lowest, highest) label of a MapBuffer or None
+  if it is empty: the leftmost and rightmost Eytzinger nodes.
+  """
+  labels = mb.keys_array()
+  N = len(labels)
+  if N == 0:
+    return None
+  k = 1
+  while 2 * k <= N:
+    k = 2 * k
+  lo = int(labels[k - 1])
+  k = 1
+  while 2 * k + 1 <= N:
+    k = 2 * k + 1
+  return (lo, int(labels[k - 1]))
+
+def build_directory(paths, parallel=8):
+  """
+  Open each MapBuffer file once and record its label range,
+  number of labels, and a copy of its Bloom filter (or None).
+
+  Returns: (lo, hi, sizes, filters)
+  """
+  def describe(path):
+    with MapBuffer.open(path) as mb:
+      bounds = label_bounds(mb)
+      bloom = mb.bloom_filter()
+      bloom = None if bloom is None else bytes(bloom)
+      if bounds is None:
+        return (1, 0, 0, None)
+      return (bounds[0], bounds[1], len(mb), bloom)
+
+  parallel = normalize_parallel(parallel)
+  if parallel == 1 or len(paths) <= 1:
+    described = [ describe(path) for path in paths ]
+  else:
+    with ThreadPoolExecutor(max_workers=min(parallel, len(paths))) as executor:
+      described = list(executor.map(describe, paths))
+
+  lo = np.array([ d[0] for d in described ], dtype=np.uint64)
+  hi = np.array([ d[1] for d in described ], dtype=np.uint64)
+  sizes = np.array([ d[2] for d in described ], dtype=np.uint64)
+  filters = [ d[3] for d in described ]
+  return (lo, hi, sizes, filters)
@@ -1,5 +1,7 @@
+from concurrent.futures import ThreadPoolExecutor
 import copy
 import sys
+import threading
 
 import brotli
 import deflate
@@ -8,7 +10,7 @@ import zstandard as zstd
 
 from tqdm import tqdm
 
-from .lib import toiter
+from .lib import toiter, normalize_parallel
 from .exceptions import DecompressionError, CompressionError, UnsupportedCompressionType
 
 BYTE_MAPPING = {
@@ -17,14 +19,23 @@ BYTE_MAPPING = {
   b'00br': "br",
   b'zstd': "zstd", 
   b'lzma': "lzma",
+  b'zdic': "zstd-dict",
+}
+
+HEADER_MAPPING = { 
+  encoding: header.decode("ascii") 
+  for header, encoding in BYTE_MAPPING.items() 
 }
 
 COMPRESSION_TYPES = [ 
   None, False, True,
   '', 'gzip', 'br', 'zstd',
-  'lzma'
+  'lzma', 'zstd-dict'
 ]
 
+# encodings that need a shared dictionary stored in the buffer
+DICTIONARY_ENCODINGS = ( 'zstd-dict', )
+
 def transcode(
   files, encoding, level=None, 
   progress=False, in_place=False
@@ -93,7 +104,14 @@ def normalize_encoding(encoding):
   
   return encoding
 
-def decompress(content, encoding, filename='N/A'):
+def encoding_header(encoding):
+  """Returns the 4 character header code for an encoding."""
+  encoding = normalize_encoding(encoding)
+  if encoding not in HEADER_MAPPING:
+    raise UnsupportedCompressionType(str(encoding) + ' is not currently supported.')
+  return HEADER_MAPPING[encoding]
+
+def decompress(content, encoding, filename='N/A', zstd_contexts=None):
   """
   Decompress file content. 
 
@@ -102,6 +120,8 @@ def decompress(content, encoding, filename='N/A'):
     encoding: None (no compression) or 'gzip' or 'br'
   Optional:   
     filename (str:default:'N/A'): Used for debugging messages
+    zstd_contexts (ZstdContexts): reusable zstd contexts, 
+      required for 'zstd-dict' 
   Raises: 
     NotImplementedError if an unsupported codec is specified. 
     compression.EncodeError if the encoder has an issue
@@ -119,7 +139,13 @@ def decompress(content, encoding, filename='N/A'):
     elif encoding == 'br':
       return brotli_decompress(content)
     elif encoding == 'zstd':
+      if zstd_contexts is not None:
+        return zstd_contexts.decompress(content)
       return zstd_decompress(content)
+    elif encoding == 'zstd-dict':
+      if zstd_contexts is None:
+        raise DecompressionError('zstd-dict requires the dictionary stored in the MapBuffer.')
+      return zstd_contexts.decompress(content)
     elif encoding == 'lzma':
       return lzma_decompress(content)
   except DecompressionError as err:
@@ -128,13 +154,16 @@ def decompress(content, encoding, filename='N/A'):
   
   raise UnsupportedCompressionType(str(encoding) + ' is not currently supported. Supported Options: None, gzip, br')
 
-def compress(content, method='gzip', compress_level=None):
+def compress(content, method='gzip', compress_level=None, zstd_contexts=None):
   """
   Compresses file content.
 
   Required:
     content (bytes): The information to be compressed
     method (str, default: 'gzip'): None or gzip
+  Optional:
+    zstd_contexts (ZstdContexts): reusable zstd contexts, 
+      required for 'zstd-dict' 
   Raises: 
     NotImplementedError if an unsupported codec is specified. 
     compression.DecodeError if the encoder has an issue
@@ -153,12 +182,58 @@ def compress(content, method='gzip', compress_level=None):
   elif method == 'br':
     return brotli_compress(content, quality=compress_level)
   elif method == 'zstd':
+    if zstd_contexts is not None:
+      return zstd_contexts.compress(content)
     return zstd_compress(content, compress_level)
+  elif method == 'zstd-dict':
+    if zstd_contexts is None:
+      raise CompressionError('zstd-dict requires a trained dictionary.')
+    return zstd_contexts.compress(content)
   elif method == 'lzma':
     return lzma.compress(content)
   
   raise ValueError(str(method) + ' is not currently supported. Supported Options: None, gzip, br')
 
+def compress_many(
+  contents, method='gzip', compress_level=None, 
+  parallel=1, fn=None, zstd_contexts=None
+):
+  """
+  Compresses a list of contents, optionally across a thread pool.
+  The codecs release the GIL while they work, so this scales 
+  across cores. Results are returned in input order.
+
+  fn: optional function applied to each content before compression
+  parallel: number of threads (True for all cores)
+
+  Return: list of compressed content
+  """
+  parallel = normalize_parallel(parallel)
+
+  def process(block):
+    if fn is not None:
+      block = [ fn(content) for content in block ]
+    return [ 
+      compress(content, method, compress_level, zstd_contexts) 
+      for content in block 
+    ]
+
+  contents = list(contents)
+  if parallel == 1 or len(contents) < 2:
+    return process(contents)
+
+  # a few blocks per thread amortizes the task overhead
+  # while still balancing uneven value sizes
+  block_size = max(len(contents) // (parallel * 4), 1)
+  blocks = [ 
+    contents[i:i+block_size] 
+    for i in range(0, len(contents), block_size) 
+  ]
+
+  with ThreadPoolExecutor(max_workers=parallel) as executor:
+    results = executor.map(process, blocks)
+    return [ content for block in results for content in block ]
+
 def gzip_compress(content, compresslevel=None):
   if compresslevel is None:
     compresslevel = 9
@@ -176,7 +251,7 @@ def gunzip(content):
     raise DecompressionError('File contains zero bytes.')
 
   gzip_magic_numbers = [ 0x1f, 0x8b ]
-  first_two_bytes = [ byte for byte in bytearray(content)[:2] ]
+  first_two_bytes = [ byte for byte in bytearray(content[:2]) ]
   if first_two_bytes != gzip_magic_numbers:
     raise DecompressionError('File is not in gzip format. Magic numbers {}, {} did not match {}, {}.'.format(
       hex(first_two_bytes[0]), hex(first_two_bytes[1]), hex(gzip_magic_numbers[0]), hex(gzip_magic_numbers[1])
@@ -213,5 +288,57 @@ def lzma_decompress(content):
     raise DecompressionError('File contains zero bytes.')
   return lzma.decompress(content)
 
+class ZstdContexts:
+  """
+  Reusable zstd compression and decompression contexts, 
+  optionally bound to a shared dictionary. Contexts are not 
+  thread safe so each thread lazily builds its own.
+  """
+  def __init__(self, dictionary=None, level=None):
+    self.dictionary = None
+    if dictionary:
+      self.dictionary = zstd.ZstdCompressionDict(dictionary)
+    self.level = 3 if level is None else int(level)
+    self._local = threading.local()
+
+  def compressor(self):
+    ctx = getattr(self._local, "compressor", None)
+    if ctx is None:
+      ctx = zstd.ZstdCompressor(level=self.level, dict_data=self.dictionary)
+      self._local.compressor = ctx
+    return ctx
+
+  def decompressor(self):
+    ctx = getattr(self._local, "decompressor", None)
+    if ctx is None:
+      ctx = zstd.ZstdDecompressor(dict_data=self.dictionary)
+      self._local.decompressor = ctx
+    return ctx
+
+  def compress(self, content):
+    return self.compressor().compress(content)
+
+  def decompress(self, content):
+    return self.decompressor().decompress(content)
+
+def train_zstd_dictionary(samples, dict_size=112640, max_samples=10000):
+  """
+  Trains a zstd dictionary on an evenly spaced (and so 
+  deterministic) subset of samples. Returns the dictionary 
+  as bytes or b"" if there was too little data to train on.
+  """
+  samples = [ bytes(sample) for sample in samples if len(sample) ]
+  if len(samples) > max_samples:
+    step = len(samples) / max_samples
+    samples = [ samples[int(i * step)] for i in range(max_samples) ]
 
+  total = sum(( len(sample) for sample in samples ))
+  # zstd needs appreciably more sample data than dictionary
+  dict_size = min(dict_size, total // 10)
+  if len(samples) < 8 or dict_size < 256:
+    return b""
 
+  try:
+    return zstd.train_dictionary(dict_size, samples).as_bytes()
+  except zstd.ZstdError:
+    return b""
@@ -18,4 +18,10 @@ class UnsupportedCompressionType(ValueError):
   pass
 
 class ValidationError(BaseException):
+  pass
+
+class ChecksumError(ValidationError):
+  """
+  A value's bytes don't match the checksum stored in the index.
+  """
   pass
\ No newline at end of file
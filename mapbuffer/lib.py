@@ -1,3 +1,6 @@
+from concurrent.futures import ThreadPoolExecutor
+import collections
+import os
 import os.path
 import time
 import types
@@ -70,6 +73,39 @@ def sip(iterable, block_size):
   if len(block) > 0:
     yield block
 
+def normalize_parallel(parallel):
+  """Converts parallel (bool or int) into a number of threads."""
+  if parallel is True:
+    return os.cpu_count() or 1
+  elif parallel in (None, False):
+    return 1
+  return max(int(parallel), 1)
+
+def ordered_map(fn, iterable, parallel=1, block_size=64):
+  """
+  Like map, but evaluates fn across a thread pool. Results
+  are yielded in input order and at most 2 * parallel blocks 
+  of block_size inputs are in flight at once, so memory stays 
+  bounded even for very long inputs.
+  """
+  parallel = normalize_parallel(parallel)
+  if parallel == 1:
+    yield from map(fn, iterable)
+    return
+
+  def process(block):
+    return [ fn(x) for x in block ]
+
+  with ThreadPoolExecutor(max_workers=parallel) as executor:
+    pending = collections.deque()
+    for block in sip(iterable, block_size):
+      pending.append(executor.submit(process, block))
+      if len(pending) >= 2 * parallel:
+        yield from pending.popleft().result()
+
+    while pending:
+      yield from pending.popleft().result()
+
 def first(lst):
   if isinstance(lst, types.GeneratorType):
     return next(lst)
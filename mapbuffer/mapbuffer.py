@@ -1,31 +1,74 @@
+from collections import OrderedDict
 import mmap 
 import io
+import threading
 
-from .exceptions import ValidationError
-from .lib import nvl
+from .exceptions import ValidationError, ChecksumError
+from .lib import nvl, normalize_parallel, ordered_map
 from . import compression
+from . import stats as mbstats
 
 import numpy as np
 
 import mapbufferaccel
 
+# version 1 stays opt-in (format_version=1) until deployed
+# readers are upgraded as older releases misread its header
 FORMAT_VERSION = 0
+SUPPORTED_FORMAT_VERSIONS = (0, 1)
 MAGIC_NUMBERS = b"mapbufr"
 HEADER_LENGTH = 16
+# version 1 pads the header so that the label
+# array begins on a cache line boundary
+LABELS_OFFSET = 64
+# version 1 extended header fields (byte offsets)
+DICTIONARY_SIZE_OFFSET = 16 # uint64
+BLOCK_SIZE_OFFSET = 24 # uint64
+NUM_BLOCKS_OFFSET = 32 # uint64
+INDEX_FLAGS_OFFSET = 40 # uint64
+VALUE_ALIGNMENT_OFFSET = 48 # uint64
+EXTENDED_HEADER_END = 56 # bytes beyond this are reserved
+
+# version 1 index encoding flags
+LABELS_UINT32 = 0b01
+OFFSETS_UINT32 = 0b10
+CHECKSUMS_CRC32C = 0b100
+HASH_INDEX = 0b1000
+BLOOM_FILTER = 0b10000
+VALUE_PADDING = 0b100000
+INDEX_FLAGS = (
+  LABELS_UINT32 | OFFSETS_UINT32 | CHECKSUMS_CRC32C 
+  | HASH_INDEX | BLOOM_FILTER | VALUE_PADDING
+)
 
 class MapBuffer:
   """Represents a usable int->bytes dictionary as a byte string."""
   __slots__ = (
     "data", "tobytesfn", "frombytesfn", 
-    "dtype", "buffer", "_index", "_compress"
+    "dtype", "buffer", "_index", "_compress",
+    "_labels", "_offsets", "_advise", "_locked",
+    "_N", "_format_version", "_dictionary_size",
+    "_data_offset", "_zstd", "_block_size", "_num_blocks",
+    "_block_starts", "_block_offsets", "_blocks", 
+    "_block_cache_size", "_block_lock", "_index_flags",
+    "_checksums", "_verify", "_stats", "_view",
+    "_align", "_padding", "_mmap"
   )
   def __init__(
     self, data=None, compress=None,
-    tobytesfn=None, frombytesfn=None
+    tobytesfn=None, frombytesfn=None,
+    format_version=FORMAT_VERSION, parallel=1,
+    block_size=0, block_cache_size=16, compact_index=True,
+    checksums=False, verify=False, offset=0, length=None,
+    stats=None, hash_index=False, bloom_filter=False,
+    align=0
   ):
     """
-    data: dict (int->byte serializable object) or bytes 
-      (representing a MapBuffer)
+    data: dict (int->byte serializable object), a file object
+      (which is mmapped), or bytes or any other object 
+      supporting the buffer protocol (e.g. bytearray, mmap, 
+      memoryview, numpy array) representing a MapBuffer. 
+      Buffers are used in place without being copied.
     compress: string representing a valid compression type or None
       Valid: "gzip", "br", "zstd", "lzma"
     tobytesfn: function for converting dict values to byte strings
@@ -35,109 +78,969 @@ class MapBuffer:
       representations of Python objects back into a Python 
       object to simplify accessing values. 
         e.g. lambda mystr: mystr.decode("utf8")
+    format_version: layout to use when serializing a dict.
+      0: interleaved [label, offset] index
+      1: separate cache line aligned label and offset arrays
+    parallel: number of threads used to compress the values 
+      of a dict (True for all cores). Output is identical
+      to serial compression.
+    block_size: when serializing a dict (format version 1 
+      with compression), pack values in ascending label order 
+      into blocks of about this many uncompressed bytes and 
+      compress each block instead of each value. 0 disables.
+    block_cache_size: number of decompressed blocks to keep 
+      in an LRU cache for block compressed buffers.
+    compact_index: (format version 1) store the labels and/or 
+      offsets as uint32 when they all fit, halving the index.
+    checksums: (format version 1) store a CRC32C of each 
+      value's stored bytes in the index.
+    verify: check each value read against its checksum (if 
+      the buffer has them) and raise ChecksumError on mismatch.
+    offset, length: the MapBuffer occupies data[offset:offset+length] 
+      of a larger buffer (length=None for the rest of it).
+    stats: count lookups, bytes read, and time spent 
+      decompressing and in frombytesfn (see stats()). 
+      None follows mapbuffer.stats.enable().
+    hash_index: (format version 1) when serializing a dict, 
+      add a perfect hash of the labels so that lookups take a
+      constant ~3 cache misses instead of log2(N). Costs about 
+      5 bytes per label. Iteration and ranges are unaffected.
+    bloom_filter: (format version 1) when serializing a dict,
+      add a ~10 bit per label filter checked before each search 
+      so that most lookups of missing labels touch one cache 
+      line (see may_contain).
+    align: (format version 1) when serializing a dict, pad 
+      each value with zeros so that every value starts on a 
+      multiple of this many bytes (a power of two up to 256, 
+      e.g. 8, 16, or 64) for direct numpy or SIMD access (see
+      get_array). Not compatible with block_size.
     """
     self.tobytesfn = tobytesfn
     self.frombytesfn = frombytesfn
     self.dtype = np.uint64
     self.buffer = None
+    # the mapping closed by close(), which self.buffer may
+    # only be a slice of (see offset and length)
+    self._mmap = None
 
     self._index = None
+    self._labels = None
+    self._offsets = None
     self._compress = None
+    self._advise = False
+    self._locked = False
+    self._blocks = OrderedDict()
+    self._block_cache_size = int(block_cache_size)
+    self._block_lock = threading.Lock()
+    self._checksums = None
+    self._padding = None
+    self._verify = bool(verify)
+    self._stats = None
+    if mbstats.ENABLED if stats is None else stats:
+      self._stats = mbstats.Stats(parent=mbstats.GLOBAL_STATS)
 
     if isinstance(data, dict):
-      self.buffer = self.dict2buf(data, compress)
+      self.buffer = self.dict2buf(
+        data, compress, 
+        format_version=format_version, parallel=parallel,
+        block_size=block_size, compact_index=compact_index,
+        checksums=checksums, hash_index=hash_index,
+        bloom_filter=bloom_filter, align=align
+      )
     elif isinstance(data, io.IOBase):
-      self.buffer = mmap.mmap(f.fileno(), 0, prot=mmap.PROT_READ)
-    elif isinstance(data, (bytes, mmap.mmap)):
-      self.buffer = data
+      self.buffer = mmap.mmap(data.fileno(), 0, access=mmap.ACCESS_READ)
+    else:
+      self.buffer = byte_view(data)
+
+    if isinstance(self.buffer, mmap.mmap):
+      self._mmap = self.buffer
+
+    if offset or length is not None:
+      end = None if length is None else offset + length
+      self.buffer = memoryview(self.buffer)[offset:end]
+
+    self._parse_header()
+
+    # native lookups for uncompressed buffers
+    self._view = None
+    if not self._compress:
+      try:
+        self._view = mapbufferaccel.MapBufferView(self.buffer)
+      except ValueError:
+        pass # malformed, reported by validate
+
+  def _parse_header(self):
+    """Read the header fields once so lookups don't reslice the buffer."""
+    header = bytes(self.buffer[:HEADER_LENGTH])
+    if len(header) < HEADER_LENGTH:
+      raise ValueError(f"Buffer is shorter than the {HEADER_LENGTH} byte header. Got: {len(header)} bytes")
+
+    self._format_version = header[len(MAGIC_NUMBERS)]
+    self._N = int.from_bytes(header[12:16], byteorder="little", signed=False)
+    try:
+      self._compress = compression.normalize_encoding(header[8:12])
+    except KeyError:
+      # unknown codec, reported by validate
+      self._compress = header[8:12]
+
+    self._dictionary_size = 0
+    self._block_size = 0
+    self._num_blocks = None
+    self._index_flags = 0
+    self._align = 0
+    if self._format_version == 1:
+      extended = bytes(self.buffer[HEADER_LENGTH:EXTENDED_HEADER_END])
+      field = lambda offset: int.from_bytes(
+        extended[offset - HEADER_LENGTH:offset - HEADER_LENGTH + 8], 
+        byteorder="little", signed=False
+      )
+      self._dictionary_size = field(DICTIONARY_SIZE_OFFSET)
+      self._block_size = field(BLOCK_SIZE_OFFSET)
+      if self._block_size:
+        self._num_blocks = field(NUM_BLOCKS_OFFSET)
+      self._index_flags = field(INDEX_FLAGS_OFFSET)
+      self._align = field(VALUE_ALIGNMENT_OFFSET)
+
+    self._data_offset = data_offset(
+      self._format_version, self._N, 
+      self._dictionary_size, self._num_blocks,
+      self._index_flags, self._align
+    )
+    self._zstd = None
+    self._block_starts = None
+    self._block_offsets = None
+
+  def dictionary(self):
+    """Returns the shared compression dictionary (bytes) or b"" if none."""
+    if self._dictionary_size == 0:
+      return b""
+    start = dictionary_offset(
+      self._format_version, self._N, self._index_flags
+    )
+    return bytes(self.buffer[start:start + self._dictionary_size])
+
+  def zstd_contexts(self):
+    """Cached zstd contexts bound to this buffer's dictionary."""
+    if self._zstd is None:
+      self._zstd = compression.ZstdContexts(self.dictionary())
+    return self._zstd
+
+  def is_block_compressed(self):
+    """True when values are compressed in shared blocks."""
+    return self._block_size > 0
+
+  def block_table(self):
+    """
+    For block compressed buffers, returns (starts, offsets) 
+    as numpy arrays of num_blocks + 1 elements. starts[b] is 
+    the position of block b in the uncompressed value stream 
+    and offsets[b] is the byte offset of its compressed bytes 
+    in the buffer. The final elements are the uncompressed 
+    size and the length of the buffer.
+    """
+    if not self._block_size:
+      raise ValueError("This MapBuffer is not block compressed.")
+
+    if self._block_starts is None:
+      count = self._num_blocks + 1
+      table_offset = self._data_offset - 16 * count
+      self._block_starts = np.frombuffer(
+        self.buffer, dtype=np.uint64, 
+        count=count, offset=table_offset
+      )
+      self._block_offsets = np.frombuffer(
+        self.buffer, dtype=np.uint64, 
+        count=count, offset=table_offset + 8 * count
+      )
+    return (self._block_starts, self._block_offsets)
+
+  def getblock(self, block):
+    """
+    Returns the decompressed bytes of a block, consulting 
+    and updating the LRU cache of recently used blocks.
+    """
+    value = self.cached_block(block)
+    if self._stats is not None:
+      self._stats.record_block(value is not None)
+    if value is not None:
+      return value
+
+    starts, offsets = self.block_table()
+    value = self.buffer[int(offsets[block]):int(offsets[block+1])]
+    return self.cache_block(block, self.decompress_block(block, value))
+
+  def cached_block(self, block):
+    """Returns a decompressed block from the LRU cache or None."""
+    with self._block_lock:
+      value = self._blocks.get(block, None)
+      if value is not None:
+        self._blocks.move_to_end(block)
+      return value
+
+  def decompress_block(self, block, value):
+    """Decompress the stored bytes of a block."""
+    encoding = self._compress
+    if self._stats is not None:
+      start, size = mbstats.clock(), len(value)
+
+    if encoding in ('zstd', 'zstd-dict'):
+      value = compression.decompress(
+        value, encoding, f"block {block}", 
+        zstd_contexts=self.zstd_contexts()
+      )
+    else:
+      value = compression.decompress(value, encoding, f"block {block}")
+
+    if self._stats is not None:
+      self._stats.record_decompress(
+        encoding, mbstats.clock() - start, size, len(value)
+      )
+    return bytes(value)
+
+  def cache_block(self, block, value):
+    """Insert a decompressed block into the LRU cache."""
+    if self._block_cache_size > 0:
+      with self._block_lock:
+        self._blocks[block] = value
+        self._blocks.move_to_end(block)
+        while len(self._blocks) > self._block_cache_size:
+          self._blocks.popitem(last=False)
+    return value
+
+  def block_location(self, i):
+    """
+    For a block compressed buffer, returns (block, start, length) 
+    locating the value at index position i within its 
+    decompressed block. block is -1 for empty values.
+    """
+    offsets = self.offsets()
+    start = int(offsets[i])
+    successor = eytzinger_successor(i, self._N)
+    starts, _ = self.block_table()
+    if successor >= 0:
+      end = int(offsets[successor])
     else:
-      raise TypeError("data must be a dict, bytes, file, or mmap. Got: " + str(type(data)))
+      end = int(starts[-1])
+
+    if end == start:
+      return (-1, 0, 0)
+
+    block = int(np.searchsorted(starts, start, side="right")) - 1
+    return (block, start - int(starts[block]), end - start)
+
+  def _block_value(self, i, view=False):
+    """Bytes of the value at index position i of a block compressed buffer."""
+    block, start, length = self.block_location(i)
+    if block < 0:
+      return memoryview(b"") if view else b""
+
+    data = self.getblock(block)
+    if view:
+      return memoryview(data)[start:start + length]
+    return data[start:start + length]
+
+  @classmethod
+  def open(
+    cls, path, mode="mmap", advise=True, lock_index=False,
+    tobytesfn=None, frombytesfn=None, block_cache_size=16,
+    verify=False, stats=None
+  ):
+    """
+    Open a MapBuffer file.
+
+    mode: 
+      "mmap": map the file read-only so that only the pages 
+        touched by lookups are read from disk.
+      "rb": read the entire file into memory.
+    advise: (mmap only) tell the kernel that access is random
+      so it doesn't read ahead, and prefetch the value ranges
+      requested by getmany (madvise MADV_RANDOM / MADV_WILLNEED).
+    lock_index: (mmap only) mlock the header and index so 
+      lookups never fault on them. The index must fit within 
+      the process's RLIMIT_MEMLOCK.
+    block_cache_size: number of decompressed blocks to cache
+      for block compressed files.
+    verify: check values against their stored checksums.
+    stats: collect statistics (see MapBuffer)
+    """
+    if mode == "rb":
+      with open(path, "rb") as f:
+        return cls(
+          f.read(), tobytesfn=tobytesfn, frombytesfn=frombytesfn,
+          block_cache_size=block_cache_size, verify=verify,
+          stats=stats
+        )
+    elif mode != "mmap":
+      raise ValueError(f"mode must be 'mmap' or 'rb'. Got: {mode}")
+
+    with open(path, "rb") as f:
+      mbuf = cls(
+        f, tobytesfn=tobytesfn, frombytesfn=frombytesfn,
+        block_cache_size=block_cache_size, verify=verify,
+        stats=stats
+      )
+
+    if advise and hasattr(mbuf.buffer, "madvise"):
+      mbuf.buffer.madvise(mmap.MADV_RANDOM)
+      mbuf._advise = True
+
+    if lock_index:
+      mbuf.lock_index()
+
+    return mbuf
+
+  def lock_index(self):
+    """mlock the header and index of the buffer into RAM."""
+    size = min(self._data_offset, len(self.buffer))
+    mapbufferaccel.mlock(self.buffer, 0, size)
+    self._locked = True
+
+  def unlock_index(self):
+    if self._locked:
+      size = min(self._data_offset, len(self.buffer))
+      mapbufferaccel.munlock(self.buffer, 0, size)
+      self._locked = False
+
+  def willneed(self, labels):
+    """
+    Hint that the values for these labels will be read soon 
+    so the kernel can fault their pages in asynchronously.
+    Only has an effect on mmapped buffers.
+    """
+    if not self._can_advise():
+      return
+
+    positions = self.find_index_positions(labels)
+    self._willneed_positions(positions[positions >= 0])
+
+  def _can_advise(self):
+    return hasattr(self.buffer, "madvise") and hasattr(mmap, "MADV_WILLNEED")
+
+  def _willneed_positions(self, positions):
+    """
+    madvise(MADV_WILLNEED) the pages holding the values at 
+    these index positions. Ranges that share or border a page
+    are combined into one call.
+    """
+    if len(positions) == 0:
+      return
+
+    offsets = self.offsets()
+    N = len(offsets)
+    if self._block_size:
+      block_starts, block_offsets = self.block_table()
+      blocks = np.searchsorted(block_starts, offsets[positions], side="right") - 1
+      blocks = np.unique(np.minimum(blocks, self._num_blocks - 1))
+      starts = block_offsets[blocks].astype(np.int64)
+      ends = block_offsets[blocks + 1].astype(np.int64)
+    else:
+      starts = offsets[positions].astype(np.int64)
+      ends = np.full(starts.shape, len(self.buffer), dtype=np.int64)
+      has_next = positions < N - 1
+      ends[has_next] = offsets[positions[has_next] + 1]
+
+    nonempty = ends > starts
+    starts, ends = starts[nonempty], ends[nonempty]
+    if len(starts) == 0:
+      return
+
+    page = mmap.PAGESIZE
+    order = np.argsort(starts, kind="stable")
+    starts = starts[order] - (starts[order] % page)
+    ends = np.maximum.accumulate(ends[order])
+    breaks = np.flatnonzero(starts[1:] > ends[:-1]) + 1
+    first = np.concatenate([ [0], breaks ])
+    last = np.concatenate([ breaks, [ len(starts) ] ]) - 1
+    for start, end in zip(starts[first], ends[last]):
+      self.buffer.madvise(mmap.MADV_WILLNEED, int(start), int(end - start))
+
+  def _prefetched(self, positions, prefetch):
+    """
+    Yields positions while advising the kernel to read the 
+    values of the next prefetch positions ahead of time.
+    """
+    for i in range(0, len(positions), prefetch):
+      if i == 0:
+        self._willneed_positions(positions[:prefetch])
+      self._willneed_positions(positions[i + prefetch:i + 2 * prefetch])
+      yield from positions[i:i + prefetch]
+
+  def close(self):
+    """Release an mmapped buffer."""
+    self._index = None
+    self._labels = None
+    self._offsets = None
+    self._block_starts = None
+    self._block_offsets = None
+    self._checksums = None
+    self._padding = None
+    self._blocks.clear()
+    if self._view is not None:
+      self._view.release()
+      self._view = None
+    if self._mmap is not None and not self._mmap.closed:
+      self.unlock_index()
+      if isinstance(self.buffer, memoryview):
+        self.buffer.release()
+      self._mmap.close()
+
+  def __enter__(self):
+    return self
+
+  def __exit__(self, exc_type, exc_value, traceback):
+    self.close()
 
   def __len__(self):
     """Returns number of keys."""
-    return int.from_bytes(self.buffer[12:16], byteorder="little", signed=False)
+    return self._N
 
   @property
   def compress(self):
-    if self._compress:
-      return self._compress
-
-    self._compress = compression.normalize_encoding(
-      self.buffer[8:12]
-    )
     return self._compress
 
   @property
   def format_version(self):
-    return self.buffer[len(MAGIC_NUMBERS)]
+    return self._format_version
+
+  @property
+  def index_flags(self):
+    """
+    Bit flags describing the index encoding (LABELS_UINT32, 
+    OFFSETS_UINT32, CHECKSUMS_CRC32C, HASH_INDEX, BLOOM_FILTER,
+    VALUE_PADDING).
+    """
+    return self._index_flags
+
+  @property
+  def align(self):
+    """Every value starts on a multiple of this many bytes (0 if unaligned)."""
+    return self._align if self._index_flags & VALUE_PADDING else 0
 
   def __iter__(self):
     yield from self.keys()
 
   def datasize(self):
     """Returns size of data region in bytes."""
-    return len(self.buffer) - HEADER_LENGTH - len(self) * 2 * 8
+    return len(self.buffer) - self._data_offset
 
   def index(self):
-    """Get an Nx2 numpy array representing the index."""
+    """
+    Get an Nx2 numpy array representing the index. 
+    For format version 1 this is a copy as the labels
+    and offsets are stored separately.
+    """
     if self._index is not None:
       return self._index
 
-    N = len(self)
-    index_length = 2 * N * 8
-    index = self.buffer[HEADER_LENGTH:index_length+HEADER_LENGTH]
-    self._index = np.frombuffer(index, dtype=np.uint64).reshape((N,2))
+    N = self._N
+    if self._format_version == 0:
+      self._index = np.frombuffer(
+        self.buffer, dtype=np.uint64, 
+        count=2 * N, offset=HEADER_LENGTH
+      ).reshape((N,2))
+    else:
+      self._index = np.stack([ 
+        self.labels().astype(np.uint64, copy=False), 
+        self.offsets().astype(np.uint64, copy=False),
+      ], axis=1)
     return self._index
 
-  def keys(self):
-    for label, offset in self.index():
+  def labels(self):
+    """
+    Get a numpy array (uint64) of the labels in index (Eytzinger)
+    order. Compact (uint32) label columns are widened to uint64,
+    see keys_array for the stored column.
+    """
+    if self._labels is None:
+      self._labels = self._label_column().astype(np.uint64, copy=False)
+    return self._labels
+
+  def _label_column(self):
+    if self._format_version == 0:
+      return self.index()[:,0]
+
+    layout = index_layout(self._format_version, self._N, self._index_flags)
+    return np.frombuffer(
+      self.buffer, dtype=layout.label_dtype, 
+      count=self._N, offset=layout.labels
+    )
+
+  def offsets(self):
+    """
+    Get a numpy array of the value offsets in index order.
+    The dtype is uint32 for compact indices, otherwise uint64.
+    """
+    if self._offsets is not None:
+      return self._offsets
+
+    if self._format_version == 0:
+      self._offsets = self.index()[:,1]
+    else:
+      layout = index_layout(self._format_version, self._N, self._index_flags)
+      self._offsets = np.frombuffer(
+        self.buffer, dtype=layout.offset_dtype,
+        count=self._N, offset=layout.offsets
+      )
+    return self._offsets
+
+  def _storage_order(self):
+    """
+    Index positions in the order values are stored: index 
+    order, or ascending label order for block compressed 
+    buffers so iteration decompresses each block once.
+    """
+    if self._block_size:
+      return self.sorted_positions()
+    return range(self._N)
+
+  def sorted_positions(self):
+    """Index positions (uint64 numpy array) in ascending label order."""
+    positions = np.zeros((self._N,), dtype=np.uint64)
+    mapbufferaccel.eytzinger_inorder(positions)
+    return positions
+
+  def range_positions(self, lo=None, hi=None, limit=0):
+    """
+    Index positions (uint64 numpy array) of the labels in 
+    [lo, hi) in ascending label order. lo=None starts at the 
+    smallest label and hi=None continues to the largest. 
+    limit > 0 returns at most that many positions.
+
+    The range is located with one descent of the index and
+    then walked in order so only the selected part of the 
+    index is touched.
+    """
+    lo = 0 if lo is None else int(lo)
+    if hi is not None and int(hi) <= lo:
+      return np.zeros((0,), dtype=np.uint64)
+
+    positions = mapbufferaccel.range_positions(
+      self.buffer, lo, 
+      (0 if hi is None else int(hi)), hi is not None, 
+      int(limit)
+    )
+    return np.frombuffer(positions, dtype=np.uint64)
+
+  def ordered_keys(self, lo=None, hi=None, chunk_size=65536):
+    """
+    Iterate over the labels in [lo, hi) (see range_positions) 
+    in ascending order. The index is walked chunk_size labels 
+    at a time so this is cheap to start and stop early.
+    """
+    labels = self.labels()
+    while True:
+      positions = self.range_positions(lo, hi, limit=chunk_size)
+      chunk = labels[positions]
+      yield from chunk
+      if len(chunk) < chunk_size or int(chunk[-1]) == 2 ** 64 - 1:
+        return
+      lo = int(chunk[-1]) + 1
+
+  def stored_ranges(self):
+    """
+    Returns (starts, ends) numpy arrays of the byte range of 
+    each stored value in index order. Not meaningful for block
+    compressed buffers.
+    """
+    starts = self.offsets().astype(np.uint64)
+    ends = np.empty_like(starts)
+    if self._N:
+      ends[:-1] = starts[1:]
+      ends[-1] = len(self.buffer)
+    padding = self.value_padding()
+    if padding is not None:
+      ends -= padding
+    return (starts, ends)
+
+  def value_padding(self):
+    """
+    Get a numpy array (uint8) of the number of zero bytes 
+    following each value in index order or None if values 
+    aren't padded (see align).
+    """
+    if not self._index_flags & VALUE_PADDING:
+      return None
+
+    if self._padding is None:
+      layout = index_layout(self._format_version, self._N, self._index_flags)
+      self._padding = np.frombuffer(
+        self.buffer, dtype=np.uint8,
+        count=self._N, offset=layout.padding
+      )
+    return self._padding
+
+  def keys_array(self):
+    """
+    Read-only numpy view of the labels in index order 
+    (zero-copy, uint32 for compact indices else uint64).
+    """
+    labels = self._label_column().view()
+    labels.flags.writeable = False
+    return labels
+
+  def lengths_array(self):
+    """
+    Get a numpy array (uint64) of the size of each value in 
+    index order as stored, or uncompressed for block
+    compressed buffers.
+    """
+    if not self._block_size:
+      starts, ends = self.stored_ranges()
+      return ends - starts
+
+    positions = self.sorted_positions()
+    starts = self.offsets()[positions].astype(np.uint64)
+    block_starts, _ = self.block_table()
+    lengths = np.zeros((self._N,), dtype=np.uint64)
+    if self._N:
+      lengths[positions[:-1]] = starts[1:] - starts[:-1]
+      lengths[positions[-1]] = np.uint64(block_starts[-1]) - starts[-1]
+    return lengths
+
+  def isin(self, labels):
+    """
+    Returns a bool numpy array aligned with labels that is 
+    True where the label is present, using one batched search.
+    """
+    return self.find_index_positions(labels) >= 0
+
+  def _decompressed_index(self, i):
+    """The value at index position i as bytes before frombytesfn."""
+    return bytes(self.decompress(self.labels()[i], self.getrawindex(i)))
+
+  def checksums(self):
+    """
+    Get a numpy array (uint32) of the CRC32C of each value's 
+    stored bytes in index order or None if there are none. 
+    For block compressed buffers, the checksums cover the 
+    uncompressed value bytes.
+    """
+    if not self._index_flags & CHECKSUMS_CRC32C:
+      return None
+
+    if self._checksums is None:
+      layout = index_layout(self._format_version, self._N, self._index_flags)
+      self._checksums = np.frombuffer(
+        self.buffer, dtype=np.uint32,
+        count=self._N, offset=layout.checksums
+      )
+    return self._checksums
+
+  def verify_index(self, i, value):
+    """Raises ChecksumError if value doesn't match the checksum at index position i."""
+    checksums = self.checksums()
+    if checksums is None:
+      return
+    crc = mapbufferaccel.crc32c(value)
+    if crc != checksums[i]:
+      raise ChecksumError(
+        f"Checksum mismatch for label {self.labels()[i]} at index position {i}. "
+        f"Expected: {int(checksums[i]):#010x} Got: {crc:#010x}"
+      )
+
+  def sorted_labels(self):
+    """Get a numpy array (uint64) of the labels in ascending order."""
+    labels = np.zeros((self._N,), dtype=np.uint64)
+    mapbufferaccel.sorted_labels(self.buffer, labels)
+    return labels
+
+  def keys(self, sorted=False):
+    """
+    Iterate over labels in storage order or ascending order
+    if sorted. (see items)
+    """
+    if sorted or self._block_size:
+      labels = self.sorted_labels()
+    else:
+      labels = self.labels()
+    for label in labels:
       yield label
 
-  def values(self):
-    for label, value in self.items():
+  def values(self, parallel=1, sorted=False):
+    for label, value in self.items(parallel=parallel, sorted=sorted):
       yield value
 
-  def items(self):
-    N = len(self)
-    index = self.index()
-    for i in range(N):
-      label = index[i,0]
-      value = self.getindex(i)
-      yield (label, value)
+  def items(self, parallel=1, sorted=False, prefetch=1024):
+    """
+    Iterate over (label, value) in storage order (index 
+    order, or ascending label order for block compressed 
+    buffers).
 
-  def getindex(self, i):
-    index = self.index()
-    N = index.shape[0]
-    offset = index[i,1]
-    if i < N - 1:
-      next_offset = index[i+1,1]
-      value = self.buffer[offset:next_offset]
+    parallel: number of threads used to decompress and decode
+      values (True for all cores). Results still stream in 
+      order with a bounded amount of work in flight.
+    sorted: iterate in ascending label order. Outside of block
+      compressed buffers this order jumps around the data 
+      region, so for mmapped buffers the pages of the next 
+      prefetch values are requested from the kernel in advance
+      (madvise MADV_WILLNEED). 0 disables prefetching.
+    """
+    labels = self.labels()
+    if sorted:
+      positions = self.sorted_positions()
+      if prefetch and self._can_advise():
+        positions = self._prefetched(positions, int(prefetch))
+    else:
+      positions = self._storage_order()
+
+    if normalize_parallel(parallel) == 1:
+      for i in positions:
+        label = labels[i]
+        value = self.getindex(i)
+        yield (label, value)
+      return
+
+    yield from ordered_map(
+      lambda i: (labels[i], self.decode(labels[i], self.getrawindex(i))),
+      positions, parallel=parallel
+    )
+
+  def getrawindex(self, i):
+    """
+    Returns the stored (possibly compressed) bytes at index 
+    position i. For block compressed buffers, these are the
+    value's bytes within its decompressed block.
+    """
+    if self._block_size:
+      value = self._block_value(i)
     else:
-      value = self.buffer[offset:]
+      start, end = self._value_range(i)
+      value = self.buffer[start:end]
 
-    encoding = self.compress
-    if encoding:
-      value = compression.decompress(value, encoding, str(index[i,0]))
+    if self._stats is not None:
+      self._stats.record_read(len(value))
+    if self._verify:
+      self.verify_index(i, value)
+    return value
 
+  def decode(self, label, value):
+    """Decompress and apply frombytesfn to stored bytes."""
+    value = self.decompress(label, value)
+    if isinstance(value, memoryview):
+      value = bytes(value)
     if self.frombytesfn:
+      if self._stats is None:
+        return self.frombytesfn(value)
+      start = mbstats.clock()
       value = self.frombytesfn(value)
+      self._stats.record_frombytesfn(mbstats.clock() - start)
+    return value
 
-    return value  
+  def decompress(self, label, value):
+    """Decompress stored bytes."""
+    encoding = self._compress
+    if self._block_size or not encoding:
+      return value # block values were decompressed with their block
+
+    if self._stats is not None:
+      start, size = mbstats.clock(), len(value)
+
+    if encoding in ('zstd', 'zstd-dict'):
+      value = compression.decompress(
+        value, encoding, str(label), 
+        zstd_contexts=self.zstd_contexts()
+      )
+    else:
+      value = compression.decompress(value, encoding, str(label))
+
+    if self._stats is not None:
+      self._stats.record_decompress(
+        encoding, mbstats.clock() - start, size, len(value)
+      )
+    return value
+
+  def getindex(self, i):
+    return self.decode(self.labels()[i], self.getrawindex(i))
 
   def find_index_position(self, label):
-    index = self.index()
-    N = len(index)
-    if N == 0:
+    k = mapbufferaccel.find_index_position(self.buffer, label)
+    found = k >= 0 and k < self._N
+    if self._stats is not None:
+      self._stats.record_lookups(int(found), int(not found))
+    return k if found else None
+
+  def find_index_positions(self, labels):
+    """
+    Find the index positions of many labels in a single 
+    accelerated call. Returns an int64 numpy array aligned 
+    with labels where missing labels are marked with -1.
+    """
+    labels = np.ascontiguousarray(labels, dtype=np.uint64).reshape(-1)
+    positions = np.full((len(labels),), -1, dtype=np.int64)
+    if len(labels) == 0:
+      return positions
+
+    mapbufferaccel.find_index_positions(self.buffer, labels, positions)
+    if self._stats is not None:
+      hits = int(np.count_nonzero(positions >= 0))
+      self._stats.record_lookups(hits, len(positions) - hits)
+    return positions
+
+  def bloom_filter(self):
+    """
+    Returns a zero-copy view of the Bloom filter section or
+    None if there is none (see bloom_filter_blocks).
+    """
+    if not self._index_flags & BLOOM_FILTER:
       return None
+    layout = index_layout(self._format_version, self._N, self._index_flags)
+    return memoryview(self.buffer)[layout.filter:layout.end]
+
+  def may_contain(self, labels):
+    """
+    Returns a bool numpy array aligned with labels that is
+    False where a label is certainly missing. With a Bloom
+    filter only the filter is read (about 1% false positives,
+    no false negatives), otherwise membership is exact.
+    """
+    labels = np.ascontiguousarray(labels, dtype=np.uint64).reshape(-1)
+    bloom = self.bloom_filter()
+    if bloom is None:
+      return self.find_index_positions(labels) >= 0
+
+    out = np.zeros((len(labels),), dtype=np.uint8)
+    mapbufferaccel.bloom_filter_contains(bloom, labels, out)
+    return out.view(bool)
+
+  def getmany(self, labels, default=None, parallel=1):
+    """
+    Get the values for many labels at once. Returns a list 
+    aligned with labels with default substituted for 
+    missing labels.
+
+    parallel: number of threads used to decompress and decode
+      values (True for all cores)
+
+    Codecs in mapbufferaccel.NATIVE_CODECS (gzip and zstd when
+    their libraries were found at build time) are searched and
+    decompressed in a single native call.
+    """
+    labels = np.ascontiguousarray(labels, dtype=np.uint64).reshape(-1)
+    if self._advise:
+      self.willneed(labels)
+
+    if self.is_raw():
+      values = mapbufferaccel.getvalues(self.buffer, labels)
+      if default is not None:
+        values = [ (default if val is None else val) for val in values ]
+      return values
+
+    if (
+      self._compress in mapbufferaccel.NATIVE_CODECS 
+      and not self._block_size and not self._verify 
+      and self._stats is None
+    ):
+      # search and decompress in one native call
+      values = mapbufferaccel.decompress_values(
+        self.buffer, labels, self.dictionary(), 
+        normalize_parallel(parallel)
+      )
+      if values is not None:
+        fn = self.frombytesfn
+        return [
+          (default if val is None else (fn(val) if fn else val))
+          for val in values
+        ]
+
+    positions = self.find_index_positions(labels)
+    if normalize_parallel(parallel) == 1:
+      return [ 
+        (default if pos < 0 else self.getindex(pos)) 
+        for pos in positions 
+      ]
+
+    def fetch(pos):
+      if pos < 0:
+        return default
+      return self.decode(self.labels()[pos], self.getrawindex(pos))
+
+    return list(ordered_map(fetch, positions, parallel=parallel))
+
+  def is_raw(self):
+    """
+    True when stored bytes are returned as is (no compression,
+    no frombytesfn, no verification, and no stats) which enables 
+    the native extraction path.
+    """
+    return (
+      self.frombytesfn is None and not self._compress 
+      and not self._verify and self._stats is None
+    )
+
+  def getview(self, label):
+    """
+    Returns a zero-copy memoryview of the bytes stored under 
+    label (still compressed if the buffer is) or None if the 
+    label is missing. For block compressed buffers, the view
+    is into the cached decompressed block.
+    """
+    if self._block_size or self._verify or self._stats is not None:
+      pos = self.find_index_position(label)
+      if pos is None:
+        return None
+      if self._block_size:
+        value = self._block_value(pos, view=True)
+      else:
+        value = self._raw_view(pos)
+      if self._stats is not None:
+        self._stats.record_read(len(value))
+      if self._verify:
+        self.verify_index(pos, value)
+      return value
+
+    return mapbufferaccel.getvalue(self.buffer, label, True)
 
-    k = mapbufferaccel.eytzinger_binary_search(label, index)
-    if k >= 0 and k < N:
-      return k
+  def _value_range(self, i):
+    """Byte range [start, end) of the value stored at index position i."""
+    offsets = self.offsets()
+    end = int(offsets[i+1]) if i < self._N - 1 else len(self.buffer)
+    padding = self.value_padding()
+    if padding is not None:
+      end -= int(padding[i])
+    return (int(offsets[i]), end)
+
+  def _raw_view(self, i):
+    start, end = self._value_range(i)
+    return memoryview(self.buffer)[start:end]
+
+  def get_array(self, label, dtype, shape=None):
+    """
+    Returns the value stored under label as a numpy array of 
+    dtype (reshaped to shape if provided) without applying 
+    frombytesfn. For uncompressed buffers the array is a 
+    zero-copy read-only view into the buffer, which is aligned 
+    in memory for buffers written with align >= the dtype's 
+    itemsize when the buffer itself is (e.g. mmapped files). 
+    Compressed values are decompressed into a new array.
+
+    Raises KeyError if the label is missing.
+    """
+    if self._compress and not self._block_size:
+      pos = self.find_index_position(label)
+      value = None if pos is None else self._decompressed_index(pos)
+    else:
+      value = self.getview(label)
+
+    if value is None:
+      raise KeyError("{} was not found.".format(label))
 
-    return None
+    array = np.frombuffer(value, dtype=dtype)
+    if shape is not None:
+      array = array.reshape(shape)
+    return array
 
   def get(self, label, *args, **kwargs):
-    pos = self.find_index_position(label)
+    if (
+      self._view is not None and self.frombytesfn is None 
+      and not self._verify and self._stats is None
+    ):
+      value = self._view.get(label)
+      if value is not None:
+        return value
+      pos = None
+    else:
+      pos = self.find_index_position(label)
+
     if pos is None: # try to get default argument
       try:
         return args[0]
@@ -150,120 +1053,1038 @@ class MapBuffer:
     return self.getindex(pos)
 
   def __contains__(self, label):
+    if self._view is not None and self._stats is None:
+      return label in self._view
     pos = self.find_index_position(label)
     return pos is not None
 
   def __getitem__(self, label):
+    if (
+      self._view is not None and self.frombytesfn is None 
+      and not self._verify and self._stats is None
+    ):
+      return self._view[label]
+
     pos = self.find_index_position(label)
     if pos is not None:
       return self.getindex(pos)
     else:
       raise KeyError("{} was not found.".format(label))
 
-  def dict2buf(self, data, compress=None, tobytesfn=None):
-    """Structure [ index length, sorted index, data ]"""
-    labels = np.array([ int(lbl) for lbl in data.keys() ], dtype=self.dtype)
-    labels.sort()
+  def dict2buf(
+    self, data, compress=None, tobytesfn=None, 
+    format_version=FORMAT_VERSION, parallel=1,
+    block_size=0, compact_index=True, checksums=False,
+    hash_index=False, bloom_filter=False, align=0
+  ):
+    """Structure [ header, eytzinger sorted index, data ]"""
+    keys = list(data.keys())
+    labels = np.array([ int(lbl) for lbl in keys ], dtype=self.dtype)
+    sort_order = np.argsort(labels, kind="stable")
+    labels = labels[sort_order]
 
-    out = np.zeros((len(labels),), dtype=np.uint64)
-    eytzinger_sort(labels, out)
-    labels = out
+    compress = compression.normalize_encoding(compress)
+    check_alignment(align, format_version, block_size)
+    check_index_options(
+      format_version, checksums=checksums, 
+      hash_index=hash_index, bloom_filter=bloom_filter
+    )
 
-    N = len(labels)
-    N_region = N.to_bytes(4, byteorder="little", signed=False)
+    tobytesfn = nvl(tobytesfn, self.tobytesfn)
+
+    values = ( data[keys[i]] for i in sort_order )
+    dictionary = b""
+    zstd_contexts = None
+    if compress == "zstd-dict":
+      if format_version == 0:
+        raise ValueError("zstd-dict compression requires format version 1 or later.")
+      if tobytesfn:
+        values = [ tobytesfn(val) for val in values ]
+        tobytesfn = None
+      else:
+        values = list(values)
+      dictionary = compression.train_zstd_dictionary(values)
+      zstd_contexts = compression.ZstdContexts(dictionary)
+    elif compress == "zstd":
+      zstd_contexts = compression.ZstdContexts()
+
+    if block_size:
+      check_block_compression(compress, format_version, block_size)
+      if tobytesfn:
+        values = [ tobytesfn(val) for val in values ]
+      else:
+        values = list(values)
+      lengths = np.array([ len(val) for val in values ], dtype=self.dtype)
+      block_first = pack_blocks(lengths, block_size)
+      block_ends = list(block_first[1:]) + [ len(values) ]
+      blocks = compression.compress_many(
+        ( 
+          b"".join(values[first:end]) 
+          for first, end in zip(block_first, block_ends) 
+        ),
+        method=compress, parallel=parallel, 
+        zstd_contexts=zstd_contexts,
+      )
+      header_and_index, order = serialize_index(
+        labels, lengths, compress, format_version, dictionary,
+        block_size=block_size, block_first=block_first,
+        block_lengths=[ len(block) for block in blocks ],
+        compact_index=compact_index,
+        checksums=(compute_checksums(values) if checksums else None),
+        hash_index=hash_index, bloom_filter=bloom_filter,
+      )
+      return b"".join([ header_and_index ] + blocks)
+
+    # values in ascending label order
+    bytes_data = compression.compress_many(
+      values, method=compress, parallel=parallel, 
+      fn=tobytesfn, zstd_contexts=zstd_contexts,
+    )
+    lengths = np.array([ len(val) for val in bytes_data ], dtype=self.dtype)
+
+    header_and_index, order = serialize_index(
+      labels, lengths, compress, format_version, dictionary,
+      compact_index=compact_index,
+      checksums=(compute_checksums(bytes_data) if checksums else None),
+      hash_index=hash_index, bloom_filter=bloom_filter, align=align,
+    )
+
+    if align:
+      padding = [ b"\x00" * pad for pad in value_padding(lengths, align) ]
+      data_region = b"".join(
+        ( part for i in order for part in (bytes_data[i], padding[i]) )
+      )
+    else:
+      data_region = b"".join(
+        ( bytes_data[i] for i in order )
+      )
+
+    return b"".join([ header_and_index, data_region ])
+
+  @classmethod
+  def merge(
+    cls, mapbuffers, on_conflict="error", compress=None,
+    format_version=None, compact_index=True, 
+    checksums=None, tobytesfn=None, frombytesfn=None,
+    hash_index=False, bloom_filter=False, align=0
+  ):
+    """
+    Merge several MapBuffers into one. When they share a 
+    compression type (and dictionary) and aren't block 
+    compressed, the stored bytes are copied as is without 
+    being decompressed and recompressed. Otherwise the 
+    values are transcoded.
+
+    mapbuffers: MapBuffers or buffers
+    on_conflict: what to do with a label in more than one input
+      "error": raise ValueError
+      "first": keep the value from the earliest input
+      "last": keep the value from the latest input
+      function (label, [ bytes, ... ]) -> value: given the 
+        uncompressed values in input order, return the value
+        to store (converted with tobytesfn if provided)
+    compress: output compression. None uses the compression of 
+      the first input. Pass False for none.
+    format_version: layout of the output. None uses the highest 
+      version among the inputs.
+    checksums: True/False to write checksums or None to keep 
+      them if every input has them.
+    hash_index: add a hash index to the output (see MapBuffer)
+    bloom_filter: add a Bloom filter to the output (see MapBuffer)
+    align: value alignment of the output (see MapBuffer)
+
+    Returns: MapBuffer
+    """
+    mapbuffers = [ 
+      (mb if isinstance(mb, MapBuffer) else MapBuffer(mb)) 
+      for mb in mapbuffers 
+    ]
+    if on_conflict not in ("error", "first", "last") and not callable(on_conflict):
+      raise ValueError(f"on_conflict must be 'error', 'first', 'last', or a function. Got: {on_conflict}")
 
+    if compress is None:
+      compress = mapbuffers[0].compress if mapbuffers else None
     compress = compression.normalize_encoding(compress)
-    compress_header = nvl(compress, "none")
 
-    header = (
-      MAGIC_NUMBERS + bytes([ FORMAT_VERSION ]) 
-      + compress_header.zfill(4).encode("ascii") 
-      + N_region
+    if format_version is None:
+      format_version = max(
+        ( mb.format_version for mb in mapbuffers ), default=FORMAT_VERSION
+      )
+
+    if checksums is None:
+      checksums = format_version != 0 and len(mapbuffers) > 0 and all(
+        ( mb.checksums() is not None for mb in mapbuffers )
+      )
+
+    dictionaries = { mb.dictionary() for mb in mapbuffers }
+    raw_copy = (
+      all(( mb.compress == compress for mb in mapbuffers ))
+      and not any(( mb.is_block_compressed() for mb in mapbuffers ))
+      and len(dictionaries) <= 1
     )
+    dictionary = dictionaries.pop() if len(dictionaries) == 1 else b""
+    if not raw_copy or (dictionary and format_version == 0):
+      resolve = on_conflict
+      if callable(on_conflict) and tobytesfn:
+        resolve = lambda label, values: tobytesfn(on_conflict(label, values))
 
-    if N == 0:
-      return header
+      data = merge_dicts([
+        { 
+          label: (lambda mb=mb, i=i: mb._decompressed_index(i)) 
+          for i, label in enumerate(mb.labels()) 
+        }
+        for mb in mapbuffers
+      ], resolve)
+      merged = cls(
+        data, compress=compress, format_version=format_version,
+        compact_index=compact_index, checksums=checksums,
+        frombytesfn=frombytesfn, hash_index=hash_index,
+        bloom_filter=bloom_filter, align=align,
+      )
+      merged.tobytesfn = tobytesfn
+      return merged
 
-    index_length = 2 * N
-    index = np.zeros((index_length,), dtype=self.dtype)
-    index[::2] = labels
+    positions = [ mb.sorted_positions() for mb in mapbuffers ]
+    sorted_labels = [ 
+      np.ascontiguousarray(mb.labels()[pos], dtype=np.uint64) 
+      for mb, pos in zip(mapbuffers, positions) 
+    ]
+    total = sum(( len(lbls) for lbls in sorted_labels ))
+    labels = np.zeros((total,), dtype=np.uint64)
+    sources = np.zeros((total,), dtype=np.uint64)
+    ranks = np.zeros((total,), dtype=np.uint64)
+    mapbufferaccel.merge_sorted(sorted_labels, labels, sources, ranks)
+    sources = sources.astype(np.int64)
+    ranks = ranks.astype(np.int64)
 
-    noop = lambda x: x
-    tobytesfn = nvl(tobytesfn, self.tobytesfn, noop)
+    # index position in each source
+    source_positions = np.zeros((total,), dtype=np.int64)
+    for j, pos in enumerate(positions):
+      mask = sources == j
+      source_positions[mask] = pos[ranks[mask]].astype(np.int64)
 
-    bytes_data = { 
-      label: compression.compress(tobytesfn(val), method=compress) 
-      for label, val in data.items()
-    }
+    replacements = {}
+    if total > 1:
+      duplicate = labels[1:] == labels[:-1]
+      if np.any(duplicate):
+        keep = np.ones((total,), dtype=bool)
+        if on_conflict == "error":
+          dupes = np.unique(labels[1:][duplicate])
+          raise ValueError(f"Labels appear in more than one MapBuffer: {dupes[:10]}")
+        elif on_conflict == "first":
+          keep[1:] = ~duplicate
+        elif on_conflict == "last":
+          keep[:-1] = ~duplicate
+        else:
+          keep[1:] = ~duplicate
+          run_starts = np.flatnonzero(keep)
+          run_ends = np.append(run_starts[1:], total)
+          kept_index = {}
+          for n, (start, end) in enumerate(zip(run_starts, run_ends)):
+            if end - start > 1:
+              values = [ 
+                mapbuffers[sources[k]]._decompressed_index(source_positions[k])
+                for k in range(start, end)
+              ]
+              kept_index[n] = on_conflict(int(labels[start]), values)
 
-    data_region = b"".join(
-      ( bytes_data[label] for label in labels )
+          zstd_contexts = None
+          if compress in ("zstd", "zstd-dict"):
+            zstd_contexts = compression.ZstdContexts(dictionary)
+          replacements = {
+            n: compression.compress(
+              (tobytesfn(value) if tobytesfn else value), 
+              compress, zstd_contexts=zstd_contexts
+            )
+            for n, value in kept_index.items()
+          }
+
+        labels = labels[keep]
+        sources = sources[keep]
+        source_positions = source_positions[keep]
+
+    return cls._from_stored(
+      mapbuffers, labels, sources, source_positions, replacements,
+      compress, dictionary, format_version, compact_index, checksums,
+      tobytesfn=tobytesfn, frombytesfn=frombytesfn, 
+      hash_index=hash_index, bloom_filter=bloom_filter, align=align,
     )
-    index[1] = HEADER_LENGTH + index_length * 8
-    for i, label in zip(range(1, len(labels)), labels):
-      index[i*2 + 1] = index[(i-1)*2 + 1] + len(bytes_data[labels[i-1]])
 
-    return b"".join([ header, index.tobytes(), data_region ])
+  @classmethod
+  def _from_stored(
+    cls, mapbuffers, labels, sources, source_positions, replacements,
+    compress, dictionary, format_version, compact_index, checksums,
+    tobytesfn=None, frombytesfn=None, file=None, 
+    hash_index=False, bloom_filter=False, align=0
+  ):
+    """
+    Assemble a MapBuffer from the stored (still compressed) bytes
+    of other MapBuffers without decoding them. 
+
+    labels: ascending uint64 labels of the output
+    sources, source_positions: which element of mapbuffers 
+      holds each label and at which index position
+    replacements: { rank: stored bytes } overriding the copy
+    file: if provided (path or binary file object), the output 
+      is written there instead of returned.
+    """
+    N = len(labels)
+    starts = np.zeros((N,), dtype=np.uint64)
+    ends = np.zeros((N,), dtype=np.uint64)
+    source_checksums = np.zeros((N,), dtype=np.uint32)
+    for j, mb in enumerate(mapbuffers):
+      mask = sources == j
+      mb_starts, mb_ends = mb.stored_ranges()
+      starts[mask] = mb_starts[source_positions[mask]]
+      ends[mask] = mb_ends[source_positions[mask]]
+      if checksums and mb.checksums() is not None:
+        source_checksums[mask] = mb.checksums()[source_positions[mask]]
+
+    views = [ memoryview(mb.buffer) for mb in mapbuffers ]
+    values = [
+      replacements[n] if n in replacements 
+      else views[source][start:end]
+      for n, (source, start, end) in enumerate(zip(sources, starts, ends))
+    ]
+    lengths = (ends - starts).astype(np.uint64)
+    for n, value in replacements.items():
+      lengths[n] = len(value)
 
-  def todict(self):
-    return { label: val for label, val in self.items() }
+    value_checksums = None
+    if checksums:
+      if all(( mb.checksums() is not None for mb in mapbuffers )):
+        value_checksums = source_checksums
+        for n, value in replacements.items():
+          value_checksums[n] = mapbufferaccel.crc32c(value)
+      else:
+        value_checksums = compute_checksums(values)
+
+    header_and_index, order = serialize_index(
+      labels, lengths, compress, format_version, dictionary,
+      compact_index=compact_index, checksums=value_checksums,
+      hash_index=hash_index, bloom_filter=bloom_filter, align=align,
+    )
+    padding = value_padding(lengths, align)
+    if file is None:
+      buf = b"".join([ header_and_index ] + [ 
+        part for i in order 
+        for part in (values[i], b"\x00" * int(padding[i]))
+      ])
+      return cls(buf, tobytesfn=tobytesfn, frombytesfn=frombytesfn)
+
+    if isinstance(file, str):
+      with open(file, "wb") as f:
+        cls._write_stored(f, header_and_index, values, order, padding)
+    else:
+      cls._write_stored(file, header_and_index, values, order, padding)
+
+  @staticmethod
+  def _write_stored(f, header_and_index, values, order, padding):
+    f.write(header_and_index)
+    for i in order:
+      f.write(values[i])
+      if padding[i]:
+        f.write(b"\x00" * int(padding[i]))
+    f.flush()
+
+  def subset(self, labels, file=None):
+    """
+    Create a MapBuffer containing only labels (missing labels 
+    are ignored). Stored values are copied without being 
+    decompressed and the compression, dictionary, checksums, 
+    hash index, filter, and alignment of this MapBuffer are kept.
+
+    file: path or binary file object to write the result to 
+      instead of returning it.
+
+    Returns: MapBuffer (or None if file is provided)
+    """
+    labels = np.unique(np.asarray(labels, dtype=np.uint64).reshape(-1))
+    positions = self.find_index_positions(labels)
+    found = positions >= 0
+    return self._copy_positions(labels[found], positions[found], file)
+
+  def range(self, lo=None, hi=None, file=None):
+    """
+    Create a MapBuffer containing the labels in [lo, hi). 
+    None leaves that side of the range open. See subset.
+
+    Returns: MapBuffer (or None if file is provided)
+    """
+    positions = self.range_positions(lo, hi)
+    labels = self.labels()[positions].astype(np.uint64)
+    return self._copy_positions(labels, positions, file)
+
+  def _copy_positions(self, labels, positions, file):
+    """labels: ascending, positions: their index positions"""
+    checksums = self.checksums() is not None
+    hash_index = bool(self._index_flags & HASH_INDEX)
+    bloom_filter = bool(self._index_flags & BLOOM_FILTER)
+    if self._block_size:
+      # blocks are shared between neighboring values so the
+      # selected values are recompressed into new blocks
+      data = { 
+        int(label): self._decompressed_index(int(pos)) 
+        for label, pos in zip(labels, positions) 
+      }
+      mb = type(self)(
+        data, compress=self.compress, 
+        format_version=self._format_version,
+        block_size=self._block_size, checksums=checksums,
+        frombytesfn=self.frombytesfn, hash_index=hash_index,
+        bloom_filter=bloom_filter,
+      )
+      mb.tobytesfn = self.tobytesfn
+      if file is None:
+        return mb
+      if isinstance(file, str):
+        with open(file, "wb") as f:
+          f.write(mb.buffer)
+      else:
+        file.write(mb.buffer)
+        file.flush()
+      return
+
+    return type(self)._from_stored(
+      [ self ], labels, 
+      np.zeros((len(labels),), dtype=np.int64),
+      np.asarray(positions, dtype=np.int64), {},
+      self.compress, self.dictionary(), self._format_version, 
+      True, checksums,
+      tobytesfn=self.tobytesfn, frombytesfn=self.frombytesfn,
+      file=file, hash_index=hash_index, bloom_filter=bloom_filter,
+      align=self.align,
+    )
+
+  def stats(self):
+    """
+    Returns a dict of this MapBuffer's statistics (see 
+    mapbuffer.stats.Stats) or None if they aren't collected.
+    """
+    if self._stats is None:
+      return None
+    return self._stats.todict()
+
+  def reset_stats(self):
+    if self._stats is not None:
+      self._stats.reset()
+
+  def todict(self, parallel=1):
+    return { label: val for label, val in self.items(parallel=parallel) }
 
   def tobytes(self):
+    """
+    Returns the underlying buffer without copying it (bytes, 
+    mmap, or a memoryview for other buffer types).
+    """
     return self.buffer
 
   def validate(self):
-    return self.validate_buffer(self.buffer)
+    self._validate_magic(self.buffer)
+    return self._validate(self)
 
   @staticmethod
   def validate_buffer(buf):
-    mapbuf = MapBuffer(buf)
-    index = mapbuf.index()
-    if len(index) != len(mapbuf):
-      raise ValidationError(f"Index size doesn't match. len(mapbuf): {len(mapbuf)}")
+    """Validates any buffer protocol object without copying it."""
+    buf = byte_view(buf)
+    MapBuffer._validate_magic(buf)
+    return MapBuffer._validate(MapBuffer(buf))
+
+  @staticmethod
+  def _validate_magic(buf):
+    if len(buf) < HEADER_LENGTH:
+      raise ValidationError(f"Buffer is shorter than the {HEADER_LENGTH} byte header.")
 
-    magic = buf[:len(MAGIC_NUMBERS)]
+    magic = bytes(buf[:len(MAGIC_NUMBERS)])
     if magic != MAGIC_NUMBERS:
       raise ValidationError(f"Magic number mismatch. Expected: {MAGIC_NUMBERS} Got: {magic}")
 
-    if mapbuf.format_version not in (0,):
+  @staticmethod
+  def _validate(mapbuf):
+    buf = mapbuf.buffer
+    if mapbuf.format_version not in SUPPORTED_FORMAT_VERSIONS:
       raise ValidationError(f"Unsupported format version. Got: {mapbuf.format_version}")
 
     if mapbuf.compress not in compression.COMPRESSION_TYPES:
       raise ValidationError(f"Unsupported compression format. Got: {mapbuf.compress}")
 
-    if len(mapbuf) > 0:
-      offsets = index[:,1].astype(np.int64)
-      lengths = offsets[1:] - offsets[0:-1]
-      if np.any(lengths < 0):
-        raise ValidationError("Offsets are not sorted.")
+    N = len(mapbuf)
+    if len(buf) < mapbuf._data_offset:
+      raise ValidationError(f"Buffer is too short to contain an index of {N} entries.")
 
-      length = lengths.sum() + (len(buf) - offsets[-1])
-      if length != mapbuf.datasize():
-        raise ValidationError(f"Data length doesn't match offsets. Predicted: {length} Data Size: {mapbuf.datasize()}")
+    if mapbuf.format_version == 1:
+      if mapbuf.index_flags & ~INDEX_FLAGS:
+        raise ValidationError(f"Unsupported index encoding flags. Got: {mapbuf.index_flags}")
 
-      # TODO: rewrite check to ensure eytzinger order
-      # labels = index[:,0].astype(np.int64)
-      # labeldiff = labels[1:] - labels[0:-1]
-      # if np.any(labeldiff < 1):
-      #   raise ValidationError("Labels aren't sorted.")
-    elif len(buf) != HEADER_LENGTH:
+      layout = index_layout(1, N, mapbuf.index_flags)
+      if any(buf[EXTENDED_HEADER_END:layout.labels]):
+        raise ValidationError("Reserved header bytes and label padding must be zero.")
+      if any(buf[layout.labels + N * layout.label_dtype.itemsize:layout.offsets]):
+        raise ValidationError("Label column padding must be zero.")
+      if any(buf[layout.offsets + N * layout.offset_dtype.itemsize:layout.checksums]):
+        raise ValidationError("Offset column padding must be zero.")
+      if any(buf[layout.checksums + N * layout.checksum_width:layout.padding]):
+        raise ValidationError("Checksum column padding must be zero.")
+      if mapbuf.index_flags & VALUE_PADDING:
+        if any(buf[layout.padding + N:layout.hash]):
+          raise ValidationError("Value padding column padding must be zero.")
+        align = mapbuf._align
+        if align < 2 or align > 256 or align & (align - 1):
+          raise ValidationError(f"Value alignment must be a power of two from 2 to 256. Got: {align}")
+        if mapbuf.is_block_compressed():
+          raise ValidationError("Block compressed buffers can't pad values.")
+      elif mapbuf._align:
+        raise ValidationError(f"Value alignment is set without value padding. Got: {mapbuf._align}")
+      if mapbuf.index_flags & HASH_INDEX:
+        buckets, size = hash_index_shape(N)
+        pilots_end = layout.hash + 8 + 4 * buckets
+        slots_start = layout.hash + 8 + ((4 * buckets + 7) & ~7)
+        if any(buf[pilots_end:slots_start]) or any(buf[slots_start + 4 * size:layout.filter]):
+          raise ValidationError("Hash index padding must be zero.")
+      elif any(buf[layout.hash:layout.filter]):
+        raise ValidationError("Filter padding must be zero.")
+
+    if mapbuf.compress in compression.DICTIONARY_ENCODINGS:
+      try:
+        mapbuf.zstd_contexts()
+      except Exception as err:
+        raise ValidationError(f"Unable to load compression dictionary: {err}")
+
+    offsets = mapbuf.offsets()
+    if len(offsets) != N or len(mapbuf.labels()) != N:
+      raise ValidationError(f"Index size doesn't match. len(mapbuf): {N}")
+
+    # labels in eytzinger order, offsets ascending, and 
+    # checksums in one native pass
+    block_compressed = mapbuf.is_block_compressed()
+    error = mapbufferaccel.validate(
+      buf, not block_compressed, not block_compressed
+    )
+    if error is not None:
+      reason, position = error
+      if reason == "order":
+        raise ValidationError(f"Labels are not in Eytzinger order at index position {position}.")
+      elif reason == "hash":
+        raise ValidationError(f"The hash index doesn't resolve the label at index position {position}.")
+      elif reason == "filter":
+        raise ValidationError(f"The filter rejects the label at index position {position}.")
+      elif reason == "offsets":
+        raise ValidationError(f"Offsets are not sorted (or padding overruns a value) at index position {position}.")
+      raise ChecksumError(f"Checksum mismatch at index position {position}.")
+
+    if mapbuf.align:
+      index_end = data_offset(
+        1, N, mapbuf._dictionary_size, None, mapbuf.index_flags
+      )
+      if any(buf[index_end:mapbuf._data_offset]):
+        raise ValidationError("Data region alignment padding must be zero.")
+      if np.any(offsets % mapbuf.align):
+        raise ValidationError(f"Values don't start on multiples of {mapbuf.align} bytes.")
+      if np.any(mapbuf.value_padding() >= mapbuf.align):
+        raise ValidationError(f"Values are padded by {mapbuf.align} bytes or more.")
+
+    if block_compressed:
+      MapBuffer._validate_blocks(mapbuf)
+    elif N > 0:
+      if int(offsets[0]) != mapbuf._data_offset:
+        raise ValidationError(f"The first offset doesn't begin the data region. Offset: {offsets[0]} Data Region: {mapbuf._data_offset}")
+    elif len(buf) != mapbuf._data_offset:
       raise ValidationError("Format is longer than header for zero data.")
 
     return True
 
-# TODO: rewrite as a stack to prevent possible stackoverflows
-def eytzinger_sort(inpt, output, i = 0, k = 1):
+  @staticmethod
+  def _validate_blocks(mapbuf):
+    if not mapbuf.compress:
+      raise ValidationError("Block compressed buffers must specify a compression type.")
+
+    starts, offsets = mapbuf.block_table()
+    starts = starts.astype(np.int64)
+    offsets = offsets.astype(np.int64)
+    if starts[0] != 0 or np.any(starts[1:] < starts[:-1]):
+      raise ValidationError("Block starts are not sorted from zero.")
+    if offsets[0] != mapbuf._data_offset or np.any(offsets[1:] < offsets[:-1]):
+      raise ValidationError("Block offsets are not sorted from the data region.")
+    if offsets[-1] != len(mapbuf.buffer):
+      raise ValidationError(f"Block offsets don't match the buffer length. Predicted: {offsets[-1]} Buffer: {len(mapbuf.buffer)}")
+
+    if len(mapbuf) > 0:
+      # values are stored in ascending label order
+      starts_by_label = mapbuf.offsets()[mapbuf._storage_order()].astype(np.int64)
+      if starts_by_label[0] != 0 or np.any(starts_by_label[1:] < starts_by_label[:-1]):
+        raise ValidationError("Offsets are not sorted.")
+      if starts_by_label[-1] > starts[-1]:
+        raise ValidationError("Offsets extend past the final block.")
+
+    if mapbuf.checksums() is not None:
+      # storage order decompresses each block once
+      for i in mapbuf._storage_order():
+        mapbuf.verify_index(i, mapbuf._block_value(i))
+
+def byte_view(data):
+  """
+  Returns bytes and mmaps as is and other objects supporting 
+  the buffer protocol as a flat zero-copy memoryview of bytes.
+  """
+  if isinstance(data, (bytes, mmap.mmap)):
+    return data
+
+  try:
+    view = memoryview(data)
+  except TypeError:
+    raise TypeError("data must be a dict, file, or object supporting the buffer protocol. Got: " + str(type(data)))
+
+  if not view.c_contiguous:
+    raise ValueError("Buffers must be C contiguous.")
+  if view.format != "B" or view.ndim != 1:
+    view = view.cast("B")
+  return view
+
+def merge_dicts(dicts, on_conflict="error"):
+  """
+  Merge dicts whose values are functions returning bytes 
+  (so that only the winning values are materialized) using 
+  the on_conflict rules of MapBuffer.merge.
+  """
+  merged = {}
+  conflicts = {}
+  for data in dicts:
+    for label, value in data.items():
+      label = int(label)
+      if label not in merged:
+        merged[label] = value
+        continue
+
+      if on_conflict == "error":
+        raise ValueError(f"Label appears in more than one MapBuffer: {label}")
+      elif on_conflict == "last":
+        merged[label] = value
+      elif callable(on_conflict):
+        conflicts.setdefault(label, [ merged[label] ]).append(value)
+
+  return {
+    label: (
+      on_conflict(label, [ fn() for fn in conflicts[label] ]) 
+      if label in conflicts else fn()
+    )
+    for label, fn in merged.items()
+  }
+
+def serialize_index(
+  labels, lengths, compress=None, 
+  format_version=FORMAT_VERSION, dictionary=b"",
+  block_size=0, block_first=None, block_lengths=None,
+  compact_index=True, checksums=None, hash_index=False,
+  bloom_filter=False, align=0
+):
+  """
+  Generates the header and index for ascending labels whose
+  values have the given byte lengths. A compression dictionary
+  (format version 1) is stored after the index.
+
+  For block compression, lengths are uncompressed value lengths,
+  block_first holds the ascending rank of the first value in each 
+  block (see pack_blocks) and block_lengths the compressed size 
+  of each block. The block table follows the dictionary.
+
+  compact_index: (format version 1) use uint32 label and/or 
+    offset columns when every value fits.
+  checksums: (format version 1) uint32 CRC32C of each value
+    in ascending label order (see compute_checksums)
+  hash_index: (format version 1) add a perfect hash of the
+    labels for constant time lookups (see hash_index_shape)
+  bloom_filter: (format version 1) add a filter that rejects
+    most missing labels without a search (see bloom_filter_blocks)
+  align: (format version 1) start the data region and every 
+    value on a multiple of this many bytes (see value_padding)
+
+  Returns: (header and index bytes, order) where order[i] is 
+    the ascending rank of the label at index position i. The 
+    values must be written to the data region in this order
+    (or for block compression, the blocks in ascending order),
+    each followed by its value_padding zero bytes when aligned.
+  """
+  if format_version not in SUPPORTED_FORMAT_VERSIONS:
+    raise ValueError(f"Unsupported format version: {format_version}")
+
+  labels = np.ascontiguousarray(labels, dtype=np.uint64)
+  lengths = np.ascontiguousarray(lengths, dtype=np.uint64)
+
+  N = len(labels)
+  if N >= 2 ** 32:
+    raise ValueError(f"A MapBuffer can hold at most {2 ** 32 - 1} labels. Got: {N}")
+  N_region = N.to_bytes(4, byteorder="little", signed=False)
+
+  compress_header = compression.encoding_header(compress)
+
+  if dictionary and format_version == 0:
+    raise ValueError("Compression dictionaries require format version 1 or later.")
+
+  header = (
+    MAGIC_NUMBERS + bytes([ format_version ]) 
+    + compress_header.encode("ascii") 
+    + N_region
+  )
+
+  num_blocks = None
+  if block_size:
+    check_block_compression(compress, format_version, block_size)
+    num_blocks = len(block_lengths)
+
+  check_index_options(
+    format_version, checksums=(checksums is not None), 
+    hash_index=hash_index, bloom_filter=bloom_filter
+  )
+  index_flags = 0
+  if checksums is not None:
+    index_flags |= CHECKSUMS_CRC32C
+  if hash_index:
+    if hash_index_shape(N)[1] >= 2 ** 32:
+      raise ValueError(f"Too many labels for a hash index. Got: {N}")
+    index_flags |= HASH_INDEX
+  if bloom_filter:
+    index_flags |= BLOOM_FILTER
+  padding = None
+  if align:
+    check_alignment(align, format_version, block_size)
+    index_flags |= VALUE_PADDING
+    padding = value_padding(lengths, align)
+    lengths = lengths + padding
+  if compact_index and format_version == 1:
+    index_flags |= compact_index_flags(
+      labels, lengths, len(dictionary), num_blocks, index_flags, align
+    )
+
+  first_offset = data_offset(
+    format_version, N, len(dictionary), num_blocks, index_flags, align
+  )
+
+  eytz_labels = np.zeros((N,), dtype=np.uint64)
+  offsets = np.zeros((N,), dtype=np.uint64)
+  order = np.zeros((N,), dtype=np.uint64)
+  mapbufferaccel.eytzinger_index(
+    labels, lengths, first_offset,
+    eytz_labels, offsets, order
+  )
+
+  block_table = b""
+  if block_size:
+    # offsets locate values in the uncompressed stream, 
+    # which is in ascending label order
+    value_starts = np.zeros((N + 1,), dtype=np.uint64)
+    np.cumsum(lengths, out=value_starts[1:])
+    offsets = value_starts[order.astype(np.int64)] if N else offsets
+    block_starts = np.zeros((num_blocks + 1,), dtype=np.uint64)
+    block_starts[:num_blocks] = value_starts[np.asarray(block_first, dtype=np.int64)]
+    block_starts[num_blocks] = value_starts[N]
+    block_offsets = np.full((num_blocks + 1,), first_offset, dtype=np.uint64)
+    np.cumsum(np.asarray(block_lengths, dtype=np.uint64), out=block_offsets[1:])
+    block_offsets[1:] += np.uint64(first_offset)
+    block_table = block_starts.tobytes() + block_offsets.tobytes()
+
+  if format_version == 0:
+    index = np.zeros((2 * N,), dtype=np.uint64)
+    index[::2] = eytz_labels
+    index[1::2] = offsets
+    index_region = index.tobytes()
+  else:
+    extended_header = b"".join([
+      int(field).to_bytes(8, byteorder="little", signed=False)
+      for field in (len(dictionary), block_size, num_blocks or 0, index_flags, align)
+    ])
+    padding = b"\x00" * (LABELS_OFFSET - EXTENDED_HEADER_END)
+    layout = index_layout(format_version, N, index_flags)
+    # element 0 is padding so node k is at element k
+    label_region = np.zeros((N + 1,), dtype=layout.label_dtype)
+    label_region[1:] = eytz_labels
+    label_region = label_region.tobytes()
+    offset_region = offsets.astype(layout.offset_dtype).tobytes()
+    checksum_region = b""
+    if checksums is not None:
+      checksums = np.ascontiguousarray(checksums, dtype=np.uint32)
+      checksum_region = checksums[order.astype(np.int64)].tobytes()
+    padding_region = b""
+    if padding is not None:
+      padding_region = padding[order.astype(np.int64)].tobytes()
+    hash_region = b""
+    if hash_index:
+      hash_region = serialize_hash_index(eytz_labels)
+    filter_region = b""
+    if bloom_filter:
+      filter_region = np.zeros((64 * bloom_filter_blocks(N),), dtype=np.uint8)
+      mapbufferaccel.build_bloom_filter(labels, filter_region)
+      filter_region = filter_region.tobytes()
+    index_region = (
+      extended_header + padding 
+      + label_region 
+      + b"\x00" * (layout.offsets - LABELS_OFFSET - len(label_region))
+      + offset_region 
+      + b"\x00" * (layout.checksums - layout.offsets - len(offset_region))
+      + checksum_region
+      + b"\x00" * (layout.padding - layout.checksums - len(checksum_region))
+      + padding_region
+      + b"\x00" * (layout.hash - layout.padding - len(padding_region))
+      + hash_region
+      + b"\x00" * (layout.filter - layout.hash - len(hash_region))
+      + filter_region
+      + bytes(dictionary) + block_table
+    )
+    # the data region begins on a multiple of align
+    index_region += b"\x00" * (first_offset - len(header) - len(index_region))
+
+  return (header + index_region, order)
+
+def serialize_hash_index(labels):
+  """
+  Builds the hash index section for labels in index 
+  (Eytzinger) order. See hash_index_shape.
+  """
+  buckets, size = hash_index_shape(len(labels))
+  pilots = np.zeros((buckets + (buckets & 1),), dtype=np.uint32)
+  slots = np.zeros((size + (size & 1),), dtype=np.uint32)
+  seed = mapbufferaccel.build_hash_index(
+    np.ascontiguousarray(labels, dtype=np.uint64), pilots, slots
+  )
+  return (
+    int(seed).to_bytes(8, byteorder="little", signed=False)
+    + pilots.tobytes() + slots.tobytes()
+  )
+
+def data_offset(
+  format_version, N, dictionary_size=0, 
+  num_blocks=None, index_flags=0, align=0
+):
+  """
+  Byte offset of the data region for an index of N entries.
+  num_blocks is None unless the buffer is block compressed.
+  When values are aligned, the data region starts on the
+  next multiple of align.
+  """
+  if format_version == 0:
+    return HEADER_LENGTH + 2 * N * 8
+
+  offset = dictionary_offset(format_version, N, index_flags) + dictionary_size
+  if num_blocks is not None:
+    offset += 16 * (num_blocks + 1)
+  if index_flags & VALUE_PADDING and align > 1:
+    offset = (offset + align - 1) & ~(align - 1)
+  return offset
+
+def dictionary_offset(format_version, N, index_flags=0):
+  """Byte offset of the compression dictionary (version 1)."""
+  return index_layout(format_version, N, index_flags).end
+
+class IndexLayout:
+  """
+  Byte offsets of the first label, first offset, first 
+  checksum, value padding, hash index, filter, and end of 
+  an index.
+  """
+  __slots__ = ( 
+    "labels", "offsets", "checksums", "padding", "hash", 
+    "filter", "end", "label_dtype", "offset_dtype", 
+    "checksum_width"
+  )
+  def __init__(
+    self, labels, offsets, checksums, padding, hash, filter, end, 
+    label_dtype, offset_dtype, checksum_width
+  ):
+    self.labels = labels
+    self.offsets = offsets
+    self.checksums = checksums
+    self.padding = padding
+    self.hash = hash
+    self.filter = filter
+    self.end = end
+    self.label_dtype = np.dtype(label_dtype)
+    self.offset_dtype = np.dtype(offset_dtype)
+    self.checksum_width = checksum_width
+
+def index_layout(format_version, N, index_flags=0):
+  """
+  Version 1 stores N + 1 labels (element 0 is padding) from 
+  LABELS_OFFSET followed by N offsets, optionally N 
+  uint32 checksums, optionally N uint8 value paddings (see
+  value_padding), and optionally a hash index (see 
+  hash_index_shape), each padded to a multiple of 8 bytes.
+  An optional Bloom filter (see bloom_filter_blocks) follows, 
+  starting on a multiple of 64 bytes.
+  """
+  if format_version == 0:
+    end = HEADER_LENGTH + 16 * N
+    return IndexLayout(
+      HEADER_LENGTH, HEADER_LENGTH + 8, end, end, end, end, end,
+      np.uint64, np.uint64, 0
+    )
+
+  label_dtype = np.uint32 if index_flags & LABELS_UINT32 else np.uint64
+  offset_dtype = np.uint32 if index_flags & OFFSETS_UINT32 else np.uint64
+  checksum_width = 4 if index_flags & CHECKSUMS_CRC32C else 0
+  align8 = lambda x: (x + 7) & ~7
+
+  label_width = np.dtype(label_dtype).itemsize
+  offsets = LABELS_OFFSET + align8((N + 1) * label_width)
+  checksums = offsets + align8(N * np.dtype(offset_dtype).itemsize)
+  padding = checksums + align8(N * checksum_width)
+  hash_start = padding
+  if index_flags & VALUE_PADDING:
+    hash_start += align8(N)
+  end = hash_start
+  if index_flags & HASH_INDEX:
+    buckets, size = hash_index_shape(N)
+    end += 8 + align8(4 * buckets) + align8(4 * size)
+  filter_start = end
+  if index_flags & BLOOM_FILTER:
+    filter_start = (end + 63) & ~63
+    end = filter_start + 64 * bloom_filter_blocks(N)
+  return IndexLayout(
+    LABELS_OFFSET + label_width, offsets, checksums, 
+    padding, hash_start, filter_start, end, 
+    label_dtype, offset_dtype, checksum_width
+  )
+
+def hash_index_shape(N):
+  """
+  The hash index is a perfect hash (in the style of PTHash) 
+  that resolves a label with about three cache misses instead
+  of one per level of the Eytzinger tree. It is a uint64 seed,
+  a uint32 pilot per bucket of about 4 labels, and a table 
+  of uint32 index positions about 6% larger than N. Lookups 
+  verify the stored label so absent labels are never matched.
+
+  Returns: (number of buckets, number of slots)
+  """
+  return (N // 4 + 1, N + N // 16 + 1)
+
+def bloom_filter_blocks(N):
+  """
+  The Bloom filter is blocked: each label sets 7 bits within 
+  one 64 byte block (a cache line) so most missing labels are 
+  rejected with a single cache miss before the index is 
+  searched. About 10 bits per label give a ~1% false positive 
+  rate.
+  """
+  return max((N * 10 + 511) // 512, 1)
+
+def compute_checksums(values):
+  """CRC32C of each value as a uint32 numpy array."""
+  if not isinstance(values, (list, tuple)):
+    values = list(values)
+  checksums = np.zeros((len(values),), dtype=np.uint32)
+  mapbufferaccel.crc32c_many(values, checksums)
+  return checksums
+
+def compact_index_flags(
+  labels, lengths, dictionary_size=0, 
+  num_blocks=None, index_flags=0, align=0
+):
+  """
+  Picks uint32 index columns for ascending labels and value 
+  lengths when every label and offset fits.
+  """
+  N = len(labels)
+  flags = 0
+  if N == 0 or int(labels[-1]) < 2 ** 32:
+    flags |= LABELS_UINT32
+
+  # block compressed offsets are into the uncompressed stream
+  end = int(np.sum(lengths, dtype=np.uint64))
+  if num_blocks is None:
+    end += data_offset(
+      1, N, dictionary_size, None, 
+      index_flags | flags | OFFSETS_UINT32, align
+    )
+  if end < 2 ** 32:
+    flags |= OFFSETS_UINT32
+
+  return flags
+
+def check_block_compression(compress, format_version, block_size):
+  if format_version == 0:
+    raise ValueError("Block compression requires format version 1 or later.")
+  if not compress:
+    raise ValueError("Block compression requires a compression type.")
+  if block_size < 0:
+    raise ValueError(f"block_size must be positive. Got: {block_size}")
+
+def check_index_options(
+  format_version, checksums=False, hash_index=False, bloom_filter=False
+):
+  if format_version != 0:
+    return
+  if checksums:
+    raise ValueError("Checksums require format version 1 or later.")
+  if hash_index:
+    raise ValueError("Hash indices require format version 1 or later.")
+  if bloom_filter:
+    raise ValueError("Bloom filters require format version 1 or later.")
+
+def check_alignment(align, format_version, block_size=0):
+  if not align:
+    return
+  if align < 2 or align > 256 or align & (align - 1):
+    raise ValueError(f"align must be a power of two from 2 to 256. Got: {align}")
+  if format_version == 0:
+    raise ValueError("Value alignment requires format version 1 or later.")
+  if block_size:
+    raise ValueError("Value alignment isn't compatible with block compression.")
+
+def value_padding(lengths, align):
+  """
+  Number of zero bytes (uint8 numpy array) written after each 
+  value of the given lengths so that the next value starts on 
+  a multiple of align. The offsets of aligned buffers include 
+  the padding and a uint8 column in the index records it so 
+  that values are still read back exactly.
+  """
+  lengths = np.asarray(lengths, dtype=np.uint64)
+  if not align:
+    return np.zeros(lengths.shape, dtype=np.uint8)
+  mask = np.uint64(align - 1)
+  return ((np.uint64(align) - (lengths & mask)) & mask).astype(np.uint8)
+
+def pack_blocks(lengths, block_size):
+  """
+  Greedily groups consecutive values into blocks of at most
+  block_size bytes (a larger value gets a block of its own).
+  Returns the rank of the first value in each block.
+  """
+  block_first = []
+  filled = 0
+  for rank, length in enumerate(lengths):
+    length = int(length)
+    if rank == 0 or (filled > 0 and filled + length > block_size):
+      block_first.append(rank)
+      filled = 0
+    filled += length
+  return block_first
+
+def eytzinger_successor(i, N):
+  """
+  Index position of the next largest label after the one at 
+  index position i in an Eytzinger ordered array of N labels
+  or -1 if it is the largest.
+  """
+  k = i + 1 # 1-based node
+  if 2 * k + 1 <= N:
+    k = 2 * k + 1
+    while 2 * k <= N:
+      k *= 2
+  else:
+    while k & 1:
+      k >>= 1
+    k >>= 1
+  return k - 1
+
+def eytzinger_sort(inpt, output):
   """
   Takes an ascendingly sorted input and 
-  an equal sized output buffer into which to 
-  rewrite the input in eytzinger order.
+  an equal sized output buffer (uint64) into which to 
+  rewrite the input in eytzinger order. Returns
+  the number of elements written.
 
   Modified from:
   https://algorithmica.org/en/eytzinger
   """
-  if k <= len(inpt):
-    i = eytzinger_sort(inpt, output, i, 2 * k)
-    output[k - 1] = inpt[i]
-    i += 1
-    i = eytzinger_sort(inpt, output,i, 2 * k + 1)
-  return i
+  inpt = np.ascontiguousarray(inpt, dtype=np.uint64)
+  return mapbufferaccel.eytzinger_sort(inpt, output)
@@ -0,0 +1,298 @@
+from concurrent.futures import ThreadPoolExecutor
+import threading
+
+import numpy as np
+
+import mapbufferaccel
+
+from .lib import normalize_parallel, ordered_map
+from .mapbuffer import (
+  MapBuffer, HEADER_LENGTH, LABELS_OFFSET, MAGIC_NUMBERS,
+  BLOOM_FILTER, index_layout
+)
+
+class RemoteMapBuffer:
+  """
+  Reads a MapBuffer that lives somewhere only byte ranges can
+  be cheaply requested from (e.g. GCS or S3) without downloading
+  the whole file. The header and index are fetched once and
+  then each lookup only requests the byte ranges of its values.
+
+  fetch: function (start, end) -> bytes returning the bytes
+    in [start, end) of the file. end is None to read to the end
+    of the file. Requests past the end may return fewer bytes.
+    It is called from multiple threads when parallel > 1.
+
+  Example:
+
+    def fetch(start, end):
+      end = "" if end is None else end - 1
+      headers = { "Range": f"bytes={start}-{end}" }
+      return requests.get(url, headers=headers).content
+
+    mb = RemoteMapBuffer(fetch)
+    fragments = mb.getmany(labels)
+
+  When the file has a Bloom filter, only the header and the 
+  filter are fetched up front and the index is requested the 
+  first time a label passes the filter, so probing many files 
+  for labels that few of them contain skips most indices.
+  """
+  __slots__ = ( 
+    "fetch", "_index", "_header", "_filter", "_lock",
+    "_frombytesfn", "_block_cache_size",
+    "parallel", "max_gap", "verify" 
+  )
+  def __init__(
+    self, fetch, frombytesfn=None,
+    parallel=8, max_gap=4096, block_cache_size=16,
+    verify=False
+  ):
+    """
+    frombytesfn: see MapBuffer
+    parallel: maximum number of requests in flight at once
+      (True for one per core)
+    max_gap: value ranges separated by at most this many bytes
+      are coalesced into a single request.
+    block_cache_size: number of decompressed blocks to keep
+      for block compressed buffers.
+    verify: check fetched values against their stored checksums
+      and raise ChecksumError on mismatch.
+    """
+    self.fetch = fetch
+    self.parallel = parallel
+    self.max_gap = int(max_gap)
+    self.verify = bool(verify)
+
+    header = bytes(fetch(0, LABELS_OFFSET))
+    if len(header) < HEADER_LENGTH:
+      raise ValueError(f"Remote file is shorter than the {HEADER_LENGTH} byte header. Got: {len(header)} bytes")
+    if header[:len(MAGIC_NUMBERS)] != MAGIC_NUMBERS:
+      raise ValueError(f"Magic number mismatch. Expected: {MAGIC_NUMBERS} Got: {header[:len(MAGIC_NUMBERS)]}")
+
+    self._frombytesfn = frombytesfn
+    self._block_cache_size = block_cache_size
+    self._lock = threading.Lock()
+    self._index = None
+    self._filter = None
+
+    # the header alone determines how much index to request
+    self._header = MapBuffer(header)
+    if self._header.index_flags & BLOOM_FILTER:
+      layout = index_layout(
+        self._header.format_version, len(self._header), 
+        self._header.index_flags
+      )
+      self._filter = bytes(fetch(layout.filter, layout.end))
+      if len(self._filter) != layout.end - layout.filter:
+        raise ValueError(f"Remote file is too short to contain its filter. Got: {len(self._filter)} bytes")
+    else:
+      self._load_index()
+
+  @property
+  def index(self):
+    """The MapBuffer of the header and index (fetched on first use)."""
+    if self._index is None:
+      self._load_index()
+    return self._index
+
+  def _load_index(self):
+    with self._lock:
+      if self._index is not None:
+        return
+      header = bytes(self._header.buffer)
+      end = self._header._data_offset
+      if len(header) < end:
+        header += bytes(self.fetch(len(header), end))
+
+      self._index = MapBuffer(
+        header[:end], frombytesfn=self._frombytesfn,
+        block_cache_size=self._block_cache_size
+      )
+
+  def __len__(self):
+    return len(self._header)
+
+  def __iter__(self):
+    yield from self.keys()
+
+  @property
+  def compress(self):
+    return self._header.compress
+
+  @property
+  def format_version(self):
+    return self._header.format_version
+
+  def keys(self):
+    return self.index.keys()
+
+  def labels(self):
+    return self.index.labels()
+
+  def may_contain(self, labels):
+    """
+    Returns a bool numpy array that is False where a label is 
+    certainly missing, using only the filter if there is one
+    (see MapBuffer.may_contain).
+    """
+    labels = np.ascontiguousarray(labels, dtype=np.uint64).reshape(-1)
+    if self._filter is None:
+      return self.index.may_contain(labels)
+    out = np.zeros((len(labels),), dtype=np.uint8)
+    mapbufferaccel.bloom_filter_contains(self._filter, labels, out)
+    return out.view(bool)
+
+  def __contains__(self, label):
+    if self._filter is not None and not self.may_contain([ label ])[0]:
+      return False
+    return label in self.index
+
+  def get(self, label, default=None):
+    return self.getmany([ label ], default=default)[0]
+
+  def __getitem__(self, label):
+    if label not in self:
+      raise KeyError("{} was not found.".format(label))
+    return self.getmany([ label ])[0]
+
+  def getmany(self, labels, default=None, parallel=None):
+    """
+    Get the values for many labels at once. Returns a list
+    aligned with labels with default substituted for
+    missing labels. Nearby value ranges are coalesced and
+    up to parallel requests are issued at once.
+    """
+    parallel = self.parallel if parallel is None else parallel
+
+    labels = np.ascontiguousarray(labels, dtype=np.uint64).reshape(-1)
+    if self._filter is not None and not np.any(self.may_contain(labels)):
+      return [ default ] * len(labels)
+
+    index = self.index
+    positions = index.find_index_positions(labels)
+    found = [ int(pos) for pos in np.unique(positions[positions >= 0]) ]
+
+    if index.is_block_compressed():
+      raw = self._fetch_block_values(found, parallel)
+    else:
+      offsets = index.offsets()
+      N = len(index)
+      ranges = [
+        (int(offsets[pos]), (int(offsets[pos+1]) if pos < N - 1 else None))
+        for pos in found
+      ]
+      raw = self.fetch_ranges(ranges, parallel)
+      padding = index.value_padding()
+      if padding is not None:
+        raw = [ 
+          value[:len(value) - int(padding[pos])] 
+          for pos, value in zip(found, raw) 
+        ]
+
+    if self.verify:
+      for pos, value in zip(found, raw):
+        index.verify_index(pos, value)
+
+    index_labels = index.labels()
+    values = ordered_map(
+      lambda args: index.decode(index_labels[args[0]], args[1]),
+      zip(found, raw), parallel=parallel
+    )
+    values = dict(zip(found, values))
+
+    return [
+      (default if pos < 0 else values[int(pos)])
+      for pos in positions
+    ]
+
+  def _fetch_block_values(self, positions, parallel):
+    index = self.index
+    locations = [ index.block_location(pos) for pos in positions ]
+
+    blocks = {}
+    missing = []
+    for block in sorted({ loc[0] for loc in locations if loc[0] >= 0 }):
+      value = index.cached_block(block)
+      if value is None:
+        missing.append(block)
+      else:
+        blocks[block] = value
+
+    _, block_offsets = index.block_table()
+    ranges = [
+      (int(block_offsets[block]), int(block_offsets[block + 1]))
+      for block in missing
+    ]
+    decompressed = ordered_map(
+      lambda args: index.decompress_block(*args),
+      zip(missing, self.fetch_ranges(ranges, parallel)),
+      parallel=parallel
+    )
+    for block, value in zip(missing, decompressed):
+      blocks[block] = index.cache_block(block, value)
+
+    return [
+      (b"" if block < 0 else blocks[block][start:start + length])
+      for block, start, length in locations
+    ]
+
+  def fetch_ranges(self, ranges, parallel=None):
+    """
+    Fetch a list of (start, end) byte ranges (end may be None
+    for the end of the file). Ranges within max_gap bytes of
+    each other are combined into one request. Returns the
+    bytes of each range in input order.
+    """
+    if len(ranges) == 0:
+      return []
+
+    parallel = normalize_parallel(
+      self.parallel if parallel is None else parallel
+    )
+    groups = coalesce_ranges(ranges, self.max_gap)
+
+    def fetch(group):
+      start, end, _ = group
+      return bytes(self.fetch(start, end))
+
+    if parallel == 1 or len(groups) == 1:
+      responses = [ fetch(group) for group in groups ]
+    else:
+      with ThreadPoolExecutor(max_workers=min(parallel, len(groups))) as executor:
+        responses = list(executor.map(fetch, groups))
+
+    results = [ None ] * len(ranges)
+    for (group_start, _, members), data in zip(groups, responses):
+      for i in members:
+        start, end = ranges[i]
+        start -= group_start
+        end = None if end is None else end - group_start
+        results[i] = data[start:end]
+    return results
+
+def coalesce_ranges(ranges, max_gap=0):
+  """
+  Merge (start, end) byte ranges (end may be None for the end
+  of the file) that overlap or are separated by at most max_gap
+  bytes.
+
+  Returns: [ (start, end, [ indices of ranges covered ]), ... ]
+    sorted by start.
+  """
+  order = sorted(range(len(ranges)), key=lambda i: ranges[i][0])
+
+  groups = []
+  for i in order:
+    start, end = ranges[i]
+    if groups:
+      group = groups[-1]
+      group_end = group[1]
+      if group_end is None or start - group_end <= max_gap:
+        if group_end is not None and (end is None or end > group_end):
+          group[1] = end
+        group[2].append(i)
+        continue
+    groups.append([ start, end, [ i ] ])
+
+  return [ tuple(group) for group in groups ]
@@ -0,0 +1,117 @@
+import threading
+import time
+
+# When True, MapBuffers created without an explicit stats
+# argument collect statistics. See enable().
+ENABLED = False
+
+clock = time.perf_counter
+
+class Stats:
+  """
+  Counters describing where MapBuffer reads spend their time.
+  Updates are forwarded to parent (the process-wide aggregate
+  for MapBuffers) so that many buffers can be exported as one.
+
+  lookups, hits, misses: label searches
+  bytes_read: stored bytes extracted from the buffer
+  decompress: { codec: { calls, seconds, bytes_in, bytes_out } }
+  frombytesfn_calls, frombytesfn_seconds: value decoding
+  block_cache_hits, block_cache_misses: block compressed buffers
+  """
+  __slots__ = (
+    "lock", "parent", "lookups", "hits", "misses",
+    "bytes_read", "decompress", "frombytesfn_calls",
+    "frombytesfn_seconds", "block_cache_hits",
+    "block_cache_misses",
+  )
+  def __init__(self, parent=None):
+    self.lock = threading.Lock()
+    self.parent = parent
+    self.reset()
+
+  def reset(self):
+    with self.lock:
+      self.lookups = 0
+      self.hits = 0
+      self.misses = 0
+      self.bytes_read = 0
+      self.decompress = {}
+      self.frombytesfn_calls = 0
+      self.frombytesfn_seconds = 0.0
+      self.block_cache_hits = 0
+      self.block_cache_misses = 0
+
+  def record_lookups(self, hits, misses=0):
+    with self.lock:
+      self.lookups += hits + misses
+      self.hits += hits
+      self.misses += misses
+    if self.parent is not None:
+      self.parent.record_lookups(hits, misses)
+
+  def record_read(self, nbytes):
+    with self.lock:
+      self.bytes_read += nbytes
+    if self.parent is not None:
+      self.parent.record_read(nbytes)
+
+  def record_decompress(self, codec, seconds, bytes_in, bytes_out):
+    with self.lock:
+      counters = self.decompress.get(codec, None)
+      if counters is None:
+        counters = { "calls": 0, "seconds": 0.0, "bytes_in": 0, "bytes_out": 0 }
+        self.decompress[codec] = counters
+      counters["calls"] += 1
+      counters["seconds"] += seconds
+      counters["bytes_in"] += bytes_in
+      counters["bytes_out"] += bytes_out
+    if self.parent is not None:
+      self.parent.record_decompress(codec, seconds, bytes_in, bytes_out)
+
+  def record_frombytesfn(self, seconds):
+    with self.lock:
+      self.frombytesfn_calls += 1
+      self.frombytesfn_seconds += seconds
+    if self.parent is not None:
+      self.parent.record_frombytesfn(seconds)
+
+  def record_block(self, hit):
+    with self.lock:
+      if hit:
+        self.block_cache_hits += 1
+      else:
+        self.block_cache_misses += 1
+    if self.parent is not None:
+      self.parent.record_block(hit)
+
+  def todict(self):
+    with self.lock:
+      return {
+        "lookups": self.lookups,
+        "hits": self.hits,
+        "misses": self.misses,
+        "bytes_read": self.bytes_read,
+        "decompress": {
+          codec: dict(counters)
+          for codec, counters in self.decompress.items()
+        },
+        "frombytesfn_calls": self.frombytesfn_calls,
+        "frombytesfn_seconds": self.frombytesfn_seconds,
+        "block_cache_hits": self.block_cache_hits,
+        "block_cache_misses": self.block_cache_misses,
+      }
+
+GLOBAL_STATS = Stats()
+
+def enable(enabled=True):
+  """Collect statistics in MapBuffers created from now on."""
+  global ENABLED
+  ENABLED = bool(enabled)
+
+def global_stats():
+  """Returns the statistics summed over every MapBuffer that collected them."""
+  return GLOBAL_STATS.todict()
+
+def reset_global_stats():
+  GLOBAL_STATS.reset()
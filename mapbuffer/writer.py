@@ -0,0 +1,265 @@
+import array
+import tempfile
+
+import numpy as np
+
+import mapbufferaccel
+
+from . import compression
+from .mapbuffer import (
+  FORMAT_VERSION, serialize_index, value_padding,
+  pack_blocks, check_block_compression, check_alignment,
+  check_index_options
+)
+
+class MapBufferWriter:
+  """
+  Incrementally serializes (label, bytes) pairs into a MapBuffer
+  file without holding the dictionary or the data region in
+  memory. Values are spilled to a temporary file as they arrive
+  and copied into index order when the writer is closed, so peak
+  memory is about the size of the index (24 bytes per label).
+
+  Example:
+
+    with MapBufferWriter("data.mb", compress="zstd") as writer:
+      for label, fragment in fragments():
+        writer.add(label, fragment)
+  """
+  __slots__ = (
+    "file", "compress", "tobytesfn", "format_version",
+    "spill", "_owns_file", "_owns_spill", "_labels", "_spill_offsets",
+    "_lengths", "_spill_size", "_closed",
+    "dictionary", "_zstd", "block_size", "tmpdir",
+    "compact_index", "_checksums", "hash_index",
+    "bloom_filter", "align"
+  )
+  def __init__(
+    self, file, compress=None, tobytesfn=None,
+    format_version=FORMAT_VERSION, spill=None, tmpdir=None,
+    dictionary=None, block_size=0, compact_index=True,
+    checksums=False, hash_index=False, bloom_filter=False,
+    align=0
+  ):
+    """
+    file: path or writable binary file object to write the
+      MapBuffer into.
+    compress: string representing a valid compression type or None
+      Valid: "gzip", "br", "zstd", "zstd-dict", "lzma"
+    tobytesfn: function for converting values to byte strings
+      if they are not already.
+    format_version: MapBuffer layout to write (0 or 1)
+    spill: binary file object opened for reading and writing
+      that holds values until close. Values are written from its
+      current position and it is left open for the caller.
+      Default: a temporary file.
+    tmpdir: directory for the default temporary spill file
+    dictionary: bytes of a zstd dictionary (see 
+      compression.train_zstd_dictionary), required for "zstd-dict"
+      since values are compressed before all of them are seen.
+    block_size: compress values in blocks of about this many
+      bytes (see MapBuffer). Blocks are compressed on close.
+    compact_index: use uint32 index columns when they fit
+      (see MapBuffer).
+    checksums: store a CRC32C of each value in the index
+    hash_index: add a perfect hash of the labels for constant
+      time lookups (see MapBuffer)
+    bloom_filter: add a filter that rejects most missing labels
+      before the index is searched (see MapBuffer)
+    align: start every value on a multiple of this many bytes
+      (see MapBuffer). Not compatible with block_size.
+    """
+    self.compress = compression.normalize_encoding(compress)
+    self.tobytesfn = tobytesfn
+    self.format_version = format_version
+    self.dictionary = b""
+    self._zstd = None
+    self.block_size = int(block_size)
+    self.tmpdir = tmpdir
+    self.compact_index = compact_index
+    self.hash_index = hash_index
+    self.bloom_filter = bloom_filter
+    self.align = int(align or 0)
+    self._checksums = array.array("I") if checksums else None
+
+    if self.block_size:
+      check_block_compression(self.compress, format_version, self.block_size)
+    check_alignment(self.align, format_version, self.block_size)
+    check_index_options(
+      format_version, checksums=checksums, 
+      hash_index=hash_index, bloom_filter=bloom_filter
+    )
+
+    if self.compress == "zstd-dict":
+      if dictionary is None:
+        raise ValueError("zstd-dict compression requires a dictionary.")
+      if format_version == 0:
+        raise ValueError("zstd-dict compression requires format version 1 or later.")
+      self.dictionary = bytes(dictionary)
+      self._zstd = compression.ZstdContexts(self.dictionary)
+    elif self.compress == "zstd":
+      self._zstd = compression.ZstdContexts()
+
+    if isinstance(file, str):
+      self.file = open(file, "wb")
+      self._owns_file = True
+    else:
+      self.file = file
+      self._owns_file = False
+
+    if spill is None:
+      self.spill = tempfile.TemporaryFile(dir=tmpdir)
+      self._owns_spill = True
+    else:
+      self.spill = spill
+      self._owns_spill = False
+    # spill offsets are absolute positions in the spill file
+    self._spill_size = self.spill.tell()
+
+    self._labels = array.array("Q")
+    self._spill_offsets = array.array("Q")
+    self._lengths = array.array("Q")
+    self._closed = False
+
+  def __len__(self):
+    return len(self._labels)
+
+  def __enter__(self):
+    return self
+
+  def __exit__(self, exc_type, exc_value, traceback):
+    if exc_type is None:
+      self.close()
+    else:
+      self.discard()
+
+  def add(self, label, value):
+    """Add a single value. Labels must not repeat."""
+    if self._closed:
+      raise ValueError("MapBufferWriter is closed.")
+
+    if self.tobytesfn:
+      value = self.tobytesfn(value)
+    if not self.block_size:
+      value = compression.compress(
+        value, method=self.compress, zstd_contexts=self._zstd
+      )
+
+    if self._checksums is not None:
+      self._checksums.append(mapbufferaccel.crc32c(value))
+
+    self.spill.write(value)
+    self._labels.append(int(label))
+    self._spill_offsets.append(self._spill_size)
+    self._lengths.append(len(value))
+    self._spill_size += len(value)
+
+  def update(self, data):
+    """Add a dict or an iterable of (label, value) pairs."""
+    if isinstance(data, dict):
+      data = data.items()
+    for label, value in data:
+      self.add(label, value)
+
+  def close(self):
+    """Writes the header, index, and data region to file."""
+    if self._closed:
+      return
+
+    labels = np.frombuffer(self._labels, dtype=np.uint64)
+    sort_order = np.argsort(labels, kind="stable")
+    labels = labels[sort_order]
+
+    if len(labels) > 1:
+      dupes = labels[1:][labels[1:] == labels[:-1]]
+      if len(dupes):
+        self.discard()
+        raise ValueError(f"Labels were added more than once: {dupes[:10]}")
+
+    spill_offsets = np.frombuffer(self._spill_offsets, dtype=np.uint64)[sort_order]
+    lengths = np.frombuffer(self._lengths, dtype=np.uint64)[sort_order]
+    checksums = None
+    if self._checksums is not None:
+      checksums = np.frombuffer(self._checksums, dtype=np.uint32)[sort_order]
+
+    if self.block_size:
+      self._write_blocks(labels, spill_offsets, lengths, checksums)
+      return
+
+    header_and_index, order = serialize_index(
+      labels, lengths, self.compress, 
+      self.format_version, self.dictionary,
+      compact_index=self.compact_index,
+      checksums=checksums,
+      hash_index=self.hash_index,
+      bloom_filter=self.bloom_filter,
+      align=self.align,
+    )
+    self.file.write(header_and_index)
+    del header_and_index
+
+    padding = value_padding(lengths, self.align)
+    self.spill.flush()
+    for rank in order:
+      self.spill.seek(int(spill_offsets[rank]))
+      self.file.write(self.spill.read(int(lengths[rank])))
+      if padding[rank]:
+        self.file.write(b"\x00" * int(padding[rank]))
+
+    self.file.flush()
+    self.discard()
+
+  def _write_blocks(self, labels, spill_offsets, lengths, checksums):
+    """
+    Values are in ascending label order. Compress them into 
+    blocks in a second temporary file as the block table must 
+    be written before the data region.
+    """
+    block_first = pack_blocks(lengths, self.block_size)
+    block_ends = block_first[1:] + [ len(lengths) ]
+    block_lengths = []
+
+    self.spill.flush()
+    with tempfile.TemporaryFile(dir=self.tmpdir) as blocks:
+      for first, end in zip(block_first, block_ends):
+        block = []
+        for rank in range(first, end):
+          self.spill.seek(int(spill_offsets[rank]))
+          block.append(self.spill.read(int(lengths[rank])))
+        block = compression.compress(
+          b"".join(block), method=self.compress, 
+          zstd_contexts=self._zstd
+        )
+        blocks.write(block)
+        block_lengths.append(len(block))
+
+      header_and_index, order = serialize_index(
+        labels, lengths, self.compress, 
+        self.format_version, self.dictionary,
+        block_size=self.block_size, block_first=block_first,
+        block_lengths=block_lengths,
+        compact_index=self.compact_index,
+        checksums=checksums,
+        hash_index=self.hash_index,
+        bloom_filter=self.bloom_filter,
+      )
+      self.file.write(header_and_index)
+      del header_and_index
+
+      blocks.seek(0)
+      while True:
+        chunk = blocks.read(2 ** 24)
+        if not chunk:
+          break
+        self.file.write(chunk)
+
+    self.file.flush()
+    self.discard()
+
+  def discard(self):
+    """Releases resources without writing anything further."""
+    self._closed = True
+    if self._owns_spill:
+      self.spill.close()
+    if self._owns_file:
+      self.file.close()
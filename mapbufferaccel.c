@@ -4,21 +4,42 @@
 #define PY_SSIZE_T_CLEAN
 #include <Python.h>
 #include <stdint.h>
+#include <string.h>
 
 #if defined _MSC_VER
 # include <intrin.h>
 #endif
 
-uint64_t mb_ffs (uint64_t x) {
+#if defined _WIN32
+# include <windows.h>
+#else
+# include <unistd.h>
+# include <sys/mman.h>
+#endif
+
+// 1-based position of the lowest set bit of x or 0 if x is 0.
+// The descents apply it to ~k, which only has its low 32 bits
+// clear once an index grows past 2^31 labels, so the full 64 
+// bits must be scanned.
+static inline uint64_t mb_ffs (uint64_t x) {
 #if __GNUC__ > 3 || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4)
-   return __builtin_ffs(x);
+   return (uint64_t)__builtin_ffsll((long long)x);
 #elif defined _MSC_VER
-  /* _BitScanForward
+  /* _BitScanForward64
      <https://docs.microsoft.com/en-us/cpp/intrinsics/bitscanforward-bitscanforward64> */
   unsigned long bit;
-  if (_BitScanForward (&bit, x)) {
+# if defined _M_X64 || defined _M_ARM64
+  if (_BitScanForward64 (&bit, x)) {
+    return bit + 1;
+  }
+# else
+  if (_BitScanForward (&bit, (unsigned long)x)) {
     return bit + 1;
   }
+  if (_BitScanForward (&bit, (unsigned long)(x >> 32))) {
+    return bit + 33;
+  }
+# endif
   return 0;
 #else 
   if (x == 0) {
@@ -33,24 +54,453 @@ uint64_t mb_ffs (uint64_t x) {
 #endif
 }
 
-uint64_t c_eytzinger_binary_search(uint64_t x, uint64_t* array, size_t N) {
-    // int64_t block_size = 8; // two cache lines 64 * 2 / 8
-    uint64_t k = 1;
-    while (k <= (uint64_t)N) {
-        // __builtin_prefetch(array + k * block_size);
-        // multiply by 2 b/c index is [label, pos, label, pos]
-        k = 2 * k + (array[(k - 1) << 1] < x); 
+#if defined _MSC_VER && (defined _M_X64 || defined _M_IX86)
+# define MB_PREFETCH(addr) _mm_prefetch((const char*)(addr), _MM_HINT_T0)
+#elif defined __GNUC__
+# define MB_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+# define MB_PREFETCH(addr)
+#endif
+
+// Indices larger than this many bytes use the prefetching 
+// search. Set from the L2 cache size at module init.
+static size_t mb_prefetch_threshold = 1024 * 1024;
+
+size_t mb_cache_size() {
+#if defined _SC_LEVEL2_CACHE_SIZE
+    long size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (size > 0) {
+        return (size_t)size;
+    }
+#endif
+    return 1024 * 1024;
+}
+
+// The index is read-only, so the GIL is released around the 
+// native loops to let reader threads run in parallel. Releasing
+// and reacquiring it costs about as much as a cached search, so
+// it is only released for batches of at least MB_GIL_MIN_BATCH
+// elements or for single searches of an index too large for 
+// cache, where cache misses and page faults dominate.
+#define MB_GIL_MIN_BATCH 16
+
+#define MB_BEGIN_ALLOW_THREADS_IF(cond) { \
+    PyThreadState* mb_save_ = (cond) ? PyEval_SaveThread() : NULL;
+#define MB_END_ALLOW_THREADS_IF \
+    if (mb_save_ != NULL) { PyEval_RestoreThread(mb_save_); } }
+
+static inline int mb_release_gil_for_search(size_t N, size_t width, size_t stride) {
+    return N * width * stride > mb_prefetch_threshold;
+}
+
+// The search kernels read the label of (1-based) node k from
+// element (k - 1) * stride of a label column of width bytes
+// (4 or 8). Format version 0 interleaves the index as 
+// [label, pos, label, pos] (stride 2) while version 1 stores 
+// the labels contiguously (stride 1), optionally as uint32.
+// The callers pass constant widths and strides so that each
+// layout gets its own specialized loop.
+static inline uint64_t mb_element(const void* column, size_t width, uint64_t i) {
+    if (width == 4) {
+        return (uint64_t)((const uint32_t*)column)[i];
+    }
+    return ((const uint64_t*)column)[i];
+}
+
+// The 8 descendants three levels below node k are contiguous 
+// starting at node 8k. In a page aligned (e.g. mmapped) buffer
+// they begin on a cache line boundary in every layout: version 0
+// nodes are 16 bytes with the index at byte 16 (two lines) and
+// version 1 nodes are 8 or 4 bytes with the label column 
+// starting at byte 64 (within one line).
+static inline void mb_prefetch_descendants(
+    const void* labels, size_t width, size_t stride, uint64_t k
+) {
+    const char* ahead = (const char*)labels + (8 * k - 1) * stride * width;
+    MB_PREFETCH(ahead);
+    if (stride * width > 8) {
+        MB_PREFETCH(ahead + 64);
     }
+}
+
+// Converts the final position of a descent into the
+// 0-based index position of x or -1 if x is missing.
+static inline int64_t mb_eytzinger_finish(
+    uint64_t k, uint64_t x, const void* labels, size_t width, size_t stride
+) {
     k >>= mb_ffs(~k);
-    k -= 1;
 
-    if (k >= 0 && array[k << 1] == x) {
-        return k;
+    // k == 0 means x is greater than every label
+    if (k > 0 && mb_element(labels, width, (k - 1) * stride) == x) {
+        return (int64_t)(k - 1);
     }
 
     return -1;
 }
 
+static inline int64_t mb_search_kernel(
+    uint64_t x, const void* labels, size_t width, size_t stride, size_t N
+) {
+    uint64_t k = 1;
+    while (k <= (uint64_t)N) {
+        k = 2 * k + (mb_element(labels, width, (k - 1) * stride) < x); 
+    }
+    return mb_eytzinger_finish(k, x, labels, width, stride);
+}
+
+static inline int64_t mb_search_prefetch_kernel(
+    uint64_t x, const void* labels, size_t width, size_t stride, size_t N
+) {
+    uint64_t k = 1;
+    while (k <= (uint64_t)N) {
+        mb_prefetch_descendants(labels, width, stride, k);
+        k = 2 * k + (mb_element(labels, width, (k - 1) * stride) < x); 
+    }
+    return mb_eytzinger_finish(k, x, labels, width, stride);
+}
+
+// Completes a descent from node k (which is on or below the 
+// last full level of the tree) to the index position of x or -1.
+static inline int64_t mb_search_last_level(
+    uint64_t k, uint64_t x, const void* labels, size_t width, size_t stride, size_t N
+) {
+    while (k <= (uint64_t)N) {
+        k = 2 * k + (mb_element(labels, width, (k - 1) * stride) < x);
+    }
+    return mb_eytzinger_finish(k, x, labels, width, stride);
+}
+
+#define MB_SEARCH_LANES 16
+
+// Searches for M labels at once. The searches are advanced
+// in lockstep so that the cache misses of independent descents
+// overlap instead of forming one long dependent chain.
+// out[i] is the position of queries[i] in the index, or -1.
+// Software prefetching is not used here as the interleaved loads 
+// already keep the memory system busy (see compare_searches.c).
+static inline void mb_search_many_kernel(
+    const uint64_t* queries, size_t M, 
+    const void* labels, size_t width, size_t stride, size_t N, 
+    int64_t* out
+) {
+    if (N == 0) {
+        for (size_t i = 0; i < M; i++) {
+            out[i] = -1;
+        }
+        return;
+    }
+
+    uint64_t k[MB_SEARCH_LANES];
+    uint64_t x[MB_SEARCH_LANES];
+
+    // Every descent completes the full levels of the tree 
+    // together, only the last partial level differs.
+    uint64_t full = 1;
+    while (2 * full + 1 <= (uint64_t)N) {
+        full = 2 * full + 1;
+    }
+
+    for (size_t start = 0; start < M; start += MB_SEARCH_LANES) {
+        size_t lanes = M - start;
+        if (lanes > MB_SEARCH_LANES) {
+            lanes = MB_SEARCH_LANES;
+        }
+
+        for (size_t j = 0; j < lanes; j++) {
+            k[j] = 1;
+            x[j] = queries[start + j];
+        }
+
+        for (uint64_t level = 1; level <= full; level = 2 * level + 1) {
+            for (size_t j = 0; j < lanes; j++) {
+                k[j] = 2 * k[j] + (mb_element(labels, width, (k[j] - 1) * stride) < x[j]);
+            }
+        }
+
+        for (size_t j = 0; j < lanes; j++) {
+            out[start + j] = mb_search_last_level(k[j], x[j], labels, width, stride, N);
+        }
+    }
+}
+
+// The batched search is also compiled for the vector units of 
+// x86-64 CPUs: each full level of the lockstep descents gathers
+// the labels of 4 (AVX2) or 8 (AVX-512) lanes with one instruction
+// and compares them all at once. The kernel is picked at module 
+// init from the CPU's features (see mb_search_init) so generic 
+// (e.g. manylinux) builds use the widest one available.
+#if defined __x86_64__ && defined __GNUC__ && (__GNUC__ >= 5 || defined __clang__)
+# include <immintrin.h>
+# define MB_SEARCH_SIMD 1
+
+// Eytzinger nodes k of 4 lanes -> their labels widened to uint64
+__attribute__((target("avx2")))
+static inline __m256i mb_gather_avx2(
+    const void* labels, size_t width, size_t stride, __m256i k
+) {
+    __m256i i = _mm256_sub_epi64(k, _mm256_set1_epi64x(1));
+    if (stride == 2) {
+        i = _mm256_add_epi64(i, i);
+    }
+    if (width == 4) {
+        return _mm256_cvtepu32_epi64(_mm256_i64gather_epi32((const int*)labels, i, 4));
+    }
+    return _mm256_i64gather_epi64((const long long*)labels, i, 8);
+}
+
+__attribute__((target("avx2")))
+static inline void mb_search_many_avx2_kernel(
+    const uint64_t* queries, size_t M, 
+    const void* labels, size_t width, size_t stride, size_t N, 
+    int64_t* out
+) {
+    if (N == 0) {
+        for (size_t i = 0; i < M; i++) {
+            out[i] = -1;
+        }
+        return;
+    }
+
+    uint64_t full = 1;
+    while (2 * full + 1 <= (uint64_t)N) {
+        full = 2 * full + 1;
+    }
+
+    // AVX2 only compares signed integers, so both sides
+    // are offset by 2^63 to compare them as unsigned
+    const __m256i sign = _mm256_set1_epi64x((long long)0x8000000000000000ULL);
+    const __m256i one = _mm256_set1_epi64x(1);
+    __m256i k[MB_SEARCH_LANES / 4];
+    __m256i x[MB_SEARCH_LANES / 4];
+    uint64_t queued[MB_SEARCH_LANES];
+    uint64_t nodes[MB_SEARCH_LANES];
+
+    for (size_t start = 0; start < M; start += MB_SEARCH_LANES) {
+        size_t lanes = M - start;
+        if (lanes > MB_SEARCH_LANES) {
+            lanes = MB_SEARCH_LANES;
+        }
+
+        // unused lanes repeat the first query
+        for (size_t j = 0; j < MB_SEARCH_LANES; j++) {
+            queued[j] = queries[start + (j < lanes ? j : 0)];
+        }
+        for (size_t v = 0; v < MB_SEARCH_LANES / 4; v++) {
+            k[v] = one;
+            x[v] = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(queued + 4 * v)), sign);
+        }
+
+        for (uint64_t level = 1; level <= full; level = 2 * level + 1) {
+            for (size_t v = 0; v < MB_SEARCH_LANES / 4; v++) {
+                __m256i found = _mm256_xor_si256(mb_gather_avx2(labels, width, stride, k[v]), sign);
+                // k = 2k + (label < x), where the comparison is -1 when true
+                __m256i less = _mm256_cmpgt_epi64(x[v], found);
+                k[v] = _mm256_sub_epi64(_mm256_add_epi64(k[v], k[v]), less);
+            }
+        }
+
+        for (size_t v = 0; v < MB_SEARCH_LANES / 4; v++) {
+            _mm256_storeu_si256((__m256i*)(nodes + 4 * v), k[v]);
+        }
+        for (size_t j = 0; j < lanes; j++) {
+            out[start + j] = mb_search_last_level(nodes[j], queued[j], labels, width, stride, N);
+        }
+    }
+}
+
+// Eytzinger nodes k of 8 lanes -> their labels widened to uint64
+__attribute__((target("avx512f")))
+static inline __m512i mb_gather_avx512(
+    const void* labels, size_t width, size_t stride, __m512i k
+) {
+    __m512i i = _mm512_sub_epi64(k, _mm512_set1_epi64(1));
+    if (stride == 2) {
+        i = _mm512_add_epi64(i, i);
+    }
+    if (width == 4) {
+        return _mm512_cvtepu32_epi64(_mm512_i64gather_epi32(i, labels, 4));
+    }
+    return _mm512_i64gather_epi64(i, labels, 8);
+}
+
+__attribute__((target("avx512f")))
+static inline void mb_search_many_avx512_kernel(
+    const uint64_t* queries, size_t M, 
+    const void* labels, size_t width, size_t stride, size_t N, 
+    int64_t* out
+) {
+    if (N == 0) {
+        for (size_t i = 0; i < M; i++) {
+            out[i] = -1;
+        }
+        return;
+    }
+
+    uint64_t full = 1;
+    while (2 * full + 1 <= (uint64_t)N) {
+        full = 2 * full + 1;
+    }
+
+    const __m512i one = _mm512_set1_epi64(1);
+    __m512i k[MB_SEARCH_LANES / 8];
+    __m512i x[MB_SEARCH_LANES / 8];
+    uint64_t queued[MB_SEARCH_LANES];
+    uint64_t nodes[MB_SEARCH_LANES];
+
+    for (size_t start = 0; start < M; start += MB_SEARCH_LANES) {
+        size_t lanes = M - start;
+        if (lanes > MB_SEARCH_LANES) {
+            lanes = MB_SEARCH_LANES;
+        }
+
+        // unused lanes repeat the first query
+        for (size_t j = 0; j < MB_SEARCH_LANES; j++) {
+            queued[j] = queries[start + (j < lanes ? j : 0)];
+        }
+        for (size_t v = 0; v < MB_SEARCH_LANES / 8; v++) {
+            k[v] = one;
+            x[v] = _mm512_loadu_si512((const void*)(queued + 8 * v));
+        }
+
+        for (uint64_t level = 1; level <= full; level = 2 * level + 1) {
+            for (size_t v = 0; v < MB_SEARCH_LANES / 8; v++) {
+                __m512i found = mb_gather_avx512(labels, width, stride, k[v]);
+                // k = 2k + (label < x)
+                __mmask8 less = _mm512_cmplt_epu64_mask(found, x[v]);
+                __m512i doubled = _mm512_add_epi64(k[v], k[v]);
+                k[v] = _mm512_mask_add_epi64(doubled, less, doubled, one);
+            }
+        }
+
+        for (size_t v = 0; v < MB_SEARCH_LANES / 8; v++) {
+            _mm512_storeu_si512((void*)(nodes + 8 * v), k[v]);
+        }
+        for (size_t j = 0; j < lanes; j++) {
+            out[start + j] = mb_search_last_level(nodes[j], queued[j], labels, width, stride, N);
+        }
+    }
+}
+#endif
+
+// The public functions specialize the kernels for each
+// layout so that the width and stride are compile time 
+// constants: interleaved uint64 (version 0), and contiguous 
+// uint64 or uint32 labels (version 1).
+
+int64_t c_eytzinger_binary_search(
+    uint64_t x, const void* labels, size_t width, size_t stride, size_t N
+) {
+    if (stride == 2) {
+        return mb_search_kernel(x, labels, 8, 2, N);
+    }
+    else if (width == 4) {
+        return mb_search_kernel(x, labels, 4, 1, N);
+    }
+    return mb_search_kernel(x, labels, 8, 1, N);
+}
+
+int64_t c_eytzinger_binary_search_prefetch(
+    uint64_t x, const void* labels, size_t width, size_t stride, size_t N
+) {
+    if (stride == 2) {
+        return mb_search_prefetch_kernel(x, labels, 8, 2, N);
+    }
+    else if (width == 4) {
+        return mb_search_prefetch_kernel(x, labels, 4, 1, N);
+    }
+    return mb_search_prefetch_kernel(x, labels, 8, 1, N);
+}
+
+// Picks the prefetching search when the labels
+// are unlikely to be cache resident.
+int64_t c_eytzinger_search(
+    uint64_t x, const void* labels, size_t width, size_t stride, size_t N
+) {
+    if (N * stride * width > mb_prefetch_threshold) {
+        return c_eytzinger_binary_search_prefetch(x, labels, width, stride, N);
+    }
+    return c_eytzinger_binary_search(x, labels, width, stride, N);
+}
+
+typedef void (*mb_search_many_fn)(
+    const uint64_t*, size_t, const void*, size_t, size_t, size_t, int64_t*
+);
+
+#define MB_SEARCH_MANY_LAYOUTS(name, kernel, attributes) \
+attributes static void name( \
+    const uint64_t* queries, size_t M, \
+    const void* labels, size_t width, size_t stride, size_t N, \
+    int64_t* out \
+) { \
+    if (stride == 2) { \
+        kernel(queries, M, labels, 8, 2, N, out); \
+    } \
+    else if (width == 4) { \
+        kernel(queries, M, labels, 4, 1, N, out); \
+    } \
+    else { \
+        kernel(queries, M, labels, 8, 1, N, out); \
+    } \
+}
+
+MB_SEARCH_MANY_LAYOUTS(mb_search_many_scalar, mb_search_many_kernel, )
+#if defined MB_SEARCH_SIMD
+MB_SEARCH_MANY_LAYOUTS(mb_search_many_avx2, mb_search_many_avx2_kernel, __attribute__((target("avx2"))))
+MB_SEARCH_MANY_LAYOUTS(mb_search_many_avx512, mb_search_many_avx512_kernel, __attribute__((target("avx512f"))))
+#endif
+
+// Batched search kernels in this build, widest last. 
+// supported is set from the CPU's features by mb_search_init.
+static struct {
+    const char* name;
+    mb_search_many_fn fn;
+    int supported;
+} mb_search_kernels[] = {
+    { "scalar", mb_search_many_scalar, 1 },
+#if defined MB_SEARCH_SIMD
+    { "avx2", mb_search_many_avx2, 0 },
+    { "avx512", mb_search_many_avx512, 0 },
+#endif
+};
+
+#define MB_NUM_SEARCH_KERNELS (sizeof(mb_search_kernels) / sizeof(mb_search_kernels[0]))
+
+static size_t mb_search_kernel_index = 0;
+static mb_search_many_fn mb_search_many_impl = mb_search_many_scalar;
+
+static void mb_search_init(void) {
+#if defined MB_SEARCH_SIMD
+    __builtin_cpu_init();
+    mb_search_kernels[1].supported = __builtin_cpu_supports("avx2");
+    mb_search_kernels[2].supported = __builtin_cpu_supports("avx512f");
+#endif
+    for (size_t i = 0; i < MB_NUM_SEARCH_KERNELS; i++) {
+        if (mb_search_kernels[i].supported) {
+            mb_search_kernel_index = i;
+        }
+    }
+    mb_search_many_impl = mb_search_kernels[mb_search_kernel_index].fn;
+}
+
+// The vector kernels are up to about 1.5x faster than the scalar one
+// while the labels are cache resident. Once most levels miss the
+// cache the descents wait on memory either way and the scalar 
+// kernel is as fast or slightly faster, so it is used for 
+// label columns larger than this many bytes.
+#define MB_VECTOR_SEARCH_MAX_BYTES (128 * 1024)
+
+void c_eytzinger_binary_search_many(
+    const uint64_t* queries, size_t M, 
+    const void* labels, size_t width, size_t stride, size_t N, 
+    int64_t* out
+) {
+    if (N * width * stride > MB_VECTOR_SEARCH_MAX_BYTES) {
+        mb_search_many_scalar(queries, M, labels, width, stride, N, out);
+        return;
+    }
+    mb_search_many_impl(queries, M, labels, width, stride, N, out);
+}
+
 static PyObject* eytzinger_binary_search(PyObject* self, PyObject *args) {
     Py_buffer index;
     Py_ssize_t label;
@@ -64,25 +514,2324 @@ static PyObject* eytzinger_binary_search(PyObject* self, PyObject *args) {
     size_t N = (size_t)index.len / 2 / 8;
     uint64_t* bytes = (uint64_t*)index.buf;
 
-    int64_t res = c_eytzinger_binary_search((uint64_t)label, bytes, N);
+    int64_t res;
+    MB_BEGIN_ALLOW_THREADS_IF(mb_release_gil_for_search(N, 8, 2))
+    res = c_eytzinger_search((uint64_t)label, bytes, 8, 2, N);
+    MB_END_ALLOW_THREADS_IF
+    PyBuffer_Release(&index);
     return Py_BuildValue("L", res); // L = long long
 }
 
-static PyMethodDef mapbufferaccel_methods[] = {
-    {"eytzinger_binary_search", (PyCFunction)eytzinger_binary_search, METH_VARARGS, "Binary search on Eytzinger sorted mapbuffer index. Arguments: uint64_t label, uint64* index"},
-    {NULL, NULL, 0, NULL}
-};
+static PyObject* eytzinger_binary_search_many(PyObject* self, PyObject *args) {
+    Py_buffer labels;
+    Py_buffer index;
+    Py_buffer out;
 
-static struct PyModuleDef mapbufferaccel_module = {
-    PyModuleDef_HEAD_INIT,
-    "mapbufferaccel",
-    "Accelerated functions for MapBuffer.",
-    -1,
-    mapbufferaccel_methods
-};
+    if (!PyArg_ParseTuple(args, "y*y*w*", &labels, &index, &out)) {
+        return NULL;
+    }
 
-PyMODINIT_FUNC PyInit_mapbufferaccel(void) {
-    return PyModule_Create(&mapbufferaccel_module);
+    size_t M = (size_t)labels.len / 8;
+    size_t N = (size_t)index.len / 2 / 8;
+
+    if ((size_t)out.len < M * 8) {
+        PyBuffer_Release(&labels);
+        PyBuffer_Release(&index);
+        PyBuffer_Release(&out);
+        PyErr_SetString(PyExc_ValueError, "Output buffer must have room for one int64 per label.");
+        return NULL;
+    }
+
+    MB_BEGIN_ALLOW_THREADS_IF(M >= MB_GIL_MIN_BATCH)
+    c_eytzinger_binary_search_many(
+        (uint64_t*)labels.buf, M,
+        index.buf, 8, 2, N,
+        (int64_t*)out.buf
+    );
+    MB_END_ALLOW_THREADS_IF
+
+    PyBuffer_Release(&labels);
+    PyBuffer_Release(&index);
+    PyBuffer_Release(&out);
+    Py_RETURN_NONE;
+}
+
+// CRC32C (Castagnoli, reflected polynomial 0x82F63B78) as used
+// by iSCSI, ext4, etc. The hardware instruction is used when 
+// the CPU has it, otherwise slicing-by-8 tables.
+static uint32_t mb_crc32c_table[8][256];
+
+static void mb_crc32c_init_table(void) {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t crc = n;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+        }
+        mb_crc32c_table[0][n] = crc;
+    }
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t crc = mb_crc32c_table[0][n];
+        for (int t = 1; t < 8; t++) {
+            crc = mb_crc32c_table[0][crc & 0xff] ^ (crc >> 8);
+            mb_crc32c_table[t][n] = crc;
+        }
+    }
+}
+
+static uint32_t mb_crc32c_sw(uint32_t crc, const unsigned char* buf, size_t len) {
+    crc = ~crc;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, buf, 8);
+        // the tables assume little endian words
+        uint32_t lo = (uint32_t)word ^ crc;
+        uint32_t hi = (uint32_t)(word >> 32);
+        crc = mb_crc32c_table[7][lo & 0xff]
+            ^ mb_crc32c_table[6][(lo >> 8) & 0xff]
+            ^ mb_crc32c_table[5][(lo >> 16) & 0xff]
+            ^ mb_crc32c_table[4][lo >> 24]
+            ^ mb_crc32c_table[3][hi & 0xff]
+            ^ mb_crc32c_table[2][(hi >> 8) & 0xff]
+            ^ mb_crc32c_table[1][(hi >> 16) & 0xff]
+            ^ mb_crc32c_table[0][hi >> 24];
+        buf += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = mb_crc32c_table[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#if (defined __x86_64__ || defined __i386__) && defined __GNUC__
+# define MB_CRC32C_HW 1
+__attribute__((target("sse4.2")))
+static uint32_t mb_crc32c_hw(uint32_t crc, const unsigned char* buf, size_t len) {
+    crc = ~crc;
+# if defined __x86_64__
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, buf, 8);
+        crc64 = __builtin_ia32_crc32di(crc64, word);
+        buf += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)crc64;
+# endif
+    while (len--) {
+        crc = __builtin_ia32_crc32qi(crc, *buf++);
+    }
+    return ~crc;
+}
+#elif defined __ARM_FEATURE_CRC32
+# include <arm_acle.h>
+# define MB_CRC32C_HW 1
+static uint32_t mb_crc32c_hw(uint32_t crc, const unsigned char* buf, size_t len) {
+    crc = ~crc;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, buf, 8);
+        crc = __crc32cd(crc, word);
+        buf += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = __crc32cb(crc, *buf++);
+    }
+    return ~crc;
+}
+#endif
+
+static uint32_t (*mb_crc32c)(uint32_t, const unsigned char*, size_t) = mb_crc32c_sw;
+
+static void mb_crc32c_init(void) {
+    mb_crc32c_init_table();
+#if defined MB_CRC32C_HW && defined __ARM_FEATURE_CRC32
+    mb_crc32c = mb_crc32c_hw;
+#elif defined MB_CRC32C_HW
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        mb_crc32c = mb_crc32c_hw;
+    }
+#endif
+}
+
+#define MB_HEADER_LENGTH 16
+#define MB_V1_LABELS_OFFSET 64
+#define MB_V1_INDEX_FLAGS_OFFSET 40
+
+// version 1 index encoding flags
+#define MB_LABELS_UINT32 0x1
+#define MB_OFFSETS_UINT32 0x2
+#define MB_CHECKSUMS_CRC32C 0x4
+#define MB_HASH_INDEX 0x8
+#define MB_BLOOM_FILTER 0x10
+#define MB_VALUE_PADDING 0x20
+#define MB_INDEX_FLAGS (MB_LABELS_UINT32 | MB_OFFSETS_UINT32 | MB_CHECKSUMS_CRC32C \
+    | MB_HASH_INDEX | MB_BLOOM_FILTER | MB_VALUE_PADDING)
+
+// The optional hash index is a perfect hash of the labels in the
+// style of PTHash. Each label hashes to one of hash_buckets 
+// buckets whose pilot (displacement) was chosen at build time so 
+// that the labels of every bucket land in distinct, free slots 
+// of a table of hash_size uint32 index positions. A lookup reads
+// the pilot, the slot, and then the stored label to verify the 
+// hit, about three cache misses regardless of N. Both sizes 
+// follow from N so the section needs no header fields:
+// [ uint64 seed ][ pilots ](pad to 8)[ slots ](pad to 8)
+#define MB_HASH_EMPTY 0xffffffffu
+
+static inline uint64_t mb_hash_mix(uint64_t x) {
+    // splitmix64 finalizer
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+// about 4 labels per bucket and a 94% full slot table
+static inline size_t mb_hash_buckets(size_t N) {
+    return N / 4 + 1;
+}
+
+static inline size_t mb_hash_size(size_t N) {
+    return N + N / 16 + 1;
+}
+
+static inline uint64_t mb_hash_bucket(uint64_t h, size_t buckets) {
+    return ((h >> 32) * (uint64_t)buckets) >> 32;
+}
+
+// The displaced hash is mixed again before the range reduction,
+// otherwise labels whose hashes share their high bits would 
+// share a slot under every pilot.
+static inline uint64_t mb_hash_slot(uint64_t h, uint32_t pilot, size_t size) {
+    return ((mb_hash_mix(h ^ mb_hash_mix(pilot)) >> 32) * (uint64_t)size) >> 32;
+}
+
+// The optional Bloom filter is blocked: each label sets 
+// MB_BLOOM_PROBES bits within one 64 byte block (a cache line,
+// the filter is 64 byte aligned) so that a missing label is 
+// usually rejected with a single cache miss before the search.
+// About 10 bits per label give roughly a 1% false positive rate.
+#define MB_BLOOM_SEED 0x9e3779b97f4a7c15ULL
+#define MB_BLOOM_PROBES 7
+#define MB_BLOOM_BLOCK_WORDS 8
+
+static inline size_t mb_bloom_blocks(size_t N) {
+    size_t blocks = (N * 10 + 511) / 512;
+    return blocks > 0 ? blocks : 1;
+}
+
+static inline const uint64_t* mb_bloom_block(
+    const uint64_t* filter, size_t blocks, uint64_t h
+) {
+    return filter + MB_BLOOM_BLOCK_WORDS * mb_hash_bucket(h, blocks);
+}
+
+// the probes are 9 bit fields of a second hash
+static inline int mb_bloom_test(const uint64_t* block, uint64_t h) {
+    uint64_t g = mb_hash_mix(h);
+    for (int i = 0; i < MB_BLOOM_PROBES; i++) {
+        uint64_t bit = (g >> (9 * i)) & 511;
+        if (!(block[bit >> 6] & ((uint64_t)1 << (bit & 63)))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static inline void mb_bloom_set(uint64_t* block, uint64_t h) {
+    uint64_t g = mb_hash_mix(h);
+    for (int i = 0; i < MB_BLOOM_PROBES; i++) {
+        uint64_t bit = (g >> (9 * i)) & 511;
+        block[bit >> 6] |= (uint64_t)1 << (bit & 63);
+    }
+}
+
+static inline int mb_bloom_contains(const uint64_t* filter, size_t blocks, uint64_t x) {
+    uint64_t h = mb_hash_mix(x ^ MB_BLOOM_SEED);
+    return mb_bloom_test(mb_bloom_block(filter, blocks, h), h);
+}
+
+// A parsed view of a serialized mapbuffer. The label of 
+// index position i is element i * stride of labels and its 
+// offset is element i * stride of offsets, with elements of
+// label_width and offset_width bytes respectively.
+typedef struct {
+    unsigned char* buf;
+    size_t len;
+    uint8_t format_version;
+    const void* labels;
+    const void* offsets;
+    size_t label_width;
+    size_t offset_width;
+    size_t stride;
+    size_t N;
+    // CRC32C of each value in index order or NULL
+    const uint32_t* checksums;
+    // zero bytes following each value in index order or NULL
+    // when values are padded to align the next one
+    const uint8_t* padding;
+    // perfect hash of the labels or NULL (see MB_HASH_INDEX)
+    const uint32_t* hash_pilots;
+    const uint32_t* hash_slots;
+    uint64_t hash_seed;
+    size_t hash_buckets;
+    size_t hash_size;
+    // blocked Bloom filter of the labels or NULL (see MB_BLOOM_FILTER)
+    const uint64_t* filter;
+    size_t filter_blocks;
+} mb_view;
+
+static inline size_t mb_align8(size_t x) {
+    return (x + 7) & ~(size_t)7;
+}
+
+// Locates the index inside a mapbuffer. Returns 0 on success
+// or -1 with a Python exception set if the buffer is malformed.
+static int mb_parse(unsigned char* buf, size_t len, mb_view* mb) {
+    if (len < MB_HEADER_LENGTH) {
+        PyErr_SetString(PyExc_ValueError, "Buffer is shorter than the mapbuffer header.");
+        return -1;
+    }
+
+    uint32_t N = 0;
+    memcpy(&N, buf + 12, sizeof(uint32_t));
+
+    mb->buf = buf;
+    mb->len = len;
+    mb->format_version = buf[7];
+    mb->N = (size_t)N;
+    mb->checksums = NULL;
+    mb->padding = NULL;
+    mb->hash_pilots = NULL;
+    mb->hash_slots = NULL;
+    mb->hash_seed = 0;
+    mb->hash_buckets = 0;
+    mb->hash_size = 0;
+    mb->filter = NULL;
+    mb->filter_blocks = 0;
+
+    if (mb->format_version == 0) {
+        // [ label, pos, label, pos, ... ]
+        if ((len - MB_HEADER_LENGTH) / 16 < (size_t)N) {
+            PyErr_SetString(PyExc_ValueError, "Buffer is too short to contain its index.");
+            return -1;
+        }
+        mb->labels = buf + MB_HEADER_LENGTH;
+        mb->offsets = buf + MB_HEADER_LENGTH + 8;
+        mb->label_width = 8;
+        mb->offset_width = 8;
+        mb->stride = 2;
+    }
+    else if (mb->format_version == 1) {
+        // [ pad, label, label, ... ](pad to 8)[ pos, pos, ... ]
+        if (len < MB_V1_LABELS_OFFSET) {
+            PyErr_SetString(PyExc_ValueError, "Buffer is too short to contain its index.");
+            return -1;
+        }
+
+        uint64_t flags = 0;
+        memcpy(&flags, buf + MB_V1_INDEX_FLAGS_OFFSET, sizeof(uint64_t));
+        if (flags & ~(uint64_t)MB_INDEX_FLAGS) {
+            PyErr_Format(PyExc_ValueError, "Unsupported index encoding: %llu", (unsigned long long)flags);
+            return -1;
+        }
+        mb->label_width = (flags & MB_LABELS_UINT32) ? 4 : 8;
+        mb->offset_width = (flags & MB_OFFSETS_UINT32) ? 4 : 8;
+
+        size_t offsets_start = MB_V1_LABELS_OFFSET 
+            + mb_align8(((size_t)N + 1) * mb->label_width);
+        if (len < offsets_start 
+            || (len - offsets_start) / mb->offset_width < (size_t)N) {
+            PyErr_SetString(PyExc_ValueError, "Buffer is too short to contain its index.");
+            return -1;
+        }
+        mb->labels = buf + MB_V1_LABELS_OFFSET + mb->label_width;
+        mb->offsets = buf + offsets_start;
+        mb->stride = 1;
+
+        size_t checksums_start = offsets_start 
+            + mb_align8((size_t)N * mb->offset_width);
+        size_t hash_start = checksums_start;
+        if (flags & MB_CHECKSUMS_CRC32C) {
+            if (len < checksums_start 
+                || (len - checksums_start) / 4 < (size_t)N) {
+                PyErr_SetString(PyExc_ValueError, "Buffer is too short to contain its checksums.");
+                return -1;
+            }
+            mb->checksums = (const uint32_t*)(buf + checksums_start);
+            hash_start += mb_align8((size_t)N * 4);
+        }
+
+        if (flags & MB_VALUE_PADDING) {
+            if (len < hash_start || len - hash_start < (size_t)N) {
+                PyErr_SetString(PyExc_ValueError, "Buffer is too short to contain its value padding.");
+                return -1;
+            }
+            mb->padding = (const uint8_t*)(buf + hash_start);
+            hash_start += mb_align8((size_t)N);
+        }
+        size_t hash_end = hash_start;
+
+        if (flags & MB_HASH_INDEX) {
+            size_t buckets = mb_hash_buckets(N);
+            size_t size = mb_hash_size(N);
+            size_t slots_start = hash_start + 8 + mb_align8(buckets * 4);
+            if ((uint64_t)size > 0xffffffffULL 
+                || len < slots_start || (len - slots_start) / 4 < size) {
+                PyErr_SetString(PyExc_ValueError, "Buffer is too short to contain its hash index.");
+                return -1;
+            }
+            memcpy(&mb->hash_seed, buf + hash_start, sizeof(uint64_t));
+            mb->hash_pilots = (const uint32_t*)(buf + hash_start + 8);
+            mb->hash_slots = (const uint32_t*)(buf + slots_start);
+            mb->hash_buckets = buckets;
+            mb->hash_size = size;
+            hash_end = slots_start + mb_align8(size * 4);
+        }
+
+        if (flags & MB_BLOOM_FILTER) {
+            size_t blocks = mb_bloom_blocks(N);
+            size_t filter_start = (hash_end + 63) & ~(size_t)63;
+            if (len < filter_start || (len - filter_start) / 64 < blocks) {
+                PyErr_SetString(PyExc_ValueError, "Buffer is too short to contain its filter.");
+                return -1;
+            }
+            mb->filter = (const uint64_t*)(buf + filter_start);
+            mb->filter_blocks = blocks;
+        }
+    }
+    else {
+        PyErr_Format(PyExc_ValueError, "Unsupported format version: %d", (int)mb->format_version);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Index position of x by its perfect hash or -1 if x is missing.
+// Positions are bounds checked as the table may be corrupt.
+static inline int64_t mb_hash_find(const mb_view* mb, uint64_t x) {
+    uint64_t h = mb_hash_mix(x ^ mb->hash_seed);
+    uint32_t pilot = mb->hash_pilots[mb_hash_bucket(h, mb->hash_buckets)];
+    uint32_t k = mb->hash_slots[mb_hash_slot(h, pilot, mb->hash_size)];
+    if (k < mb->N && mb_element(mb->labels, mb->label_width, k) == x) {
+        return (int64_t)k;
+    }
+    return -1;
+}
+
+// Resolves M labels at once, advancing MB_SEARCH_LANES lookups
+// a step at a time so that the loads of the pilot, slot, and 
+// label of each lane are prefetched while the others proceed.
+static void mb_hash_find_many(
+    const mb_view* mb, const uint64_t* queries, size_t M, int64_t* out
+) {
+    uint64_t h[MB_SEARCH_LANES];
+    uint64_t slot[MB_SEARCH_LANES];
+
+    for (size_t start = 0; start < M; start += MB_SEARCH_LANES) {
+        size_t lanes = M - start;
+        if (lanes > MB_SEARCH_LANES) {
+            lanes = MB_SEARCH_LANES;
+        }
+
+        for (size_t j = 0; j < lanes; j++) {
+            h[j] = mb_hash_mix(queries[start + j] ^ mb->hash_seed);
+            MB_PREFETCH(mb->hash_pilots + mb_hash_bucket(h[j], mb->hash_buckets));
+        }
+        for (size_t j = 0; j < lanes; j++) {
+            uint32_t pilot = mb->hash_pilots[mb_hash_bucket(h[j], mb->hash_buckets)];
+            slot[j] = mb_hash_slot(h[j], pilot, mb->hash_size);
+            MB_PREFETCH(mb->hash_slots + slot[j]);
+        }
+        for (size_t j = 0; j < lanes; j++) {
+            uint32_t k = mb->hash_slots[slot[j]];
+            slot[j] = k;
+            if (k < mb->N) {
+                MB_PREFETCH((const char*)mb->labels + (size_t)k * mb->label_width);
+            }
+        }
+        for (size_t j = 0; j < lanes; j++) {
+            uint64_t k = slot[j];
+            out[start + j] = (
+                k < mb->N 
+                && mb_element(mb->labels, mb->label_width, k) == queries[start + j]
+            ) ? (int64_t)k : -1;
+        }
+    }
+}
+
+// Index position of x or -1. Labels the filter rules out are
+// missing, the rest are resolved by the hash index when present
+// and the Eytzinger search otherwise.
+static inline int64_t mb_find(const mb_view* mb, uint64_t x) {
+    if (mb->N == 0) {
+        return -1;
+    }
+    if (mb->filter != NULL && !mb_bloom_contains(mb->filter, mb->filter_blocks, x)) {
+        return -1;
+    }
+    if (mb->hash_slots != NULL) {
+        return mb_hash_find(mb, x);
+    }
+    return c_eytzinger_search(x, mb->labels, mb->label_width, mb->stride, mb->N);
+}
+
+static inline void mb_search_many(
+    const mb_view* mb, const uint64_t* queries, size_t M, int64_t* out
+) {
+    if (mb->hash_slots != NULL && mb->N > 0) {
+        mb_hash_find_many(mb, queries, M, out);
+        return;
+    }
+    c_eytzinger_binary_search_many(
+        queries, M, mb->labels, mb->label_width, mb->stride, mb->N, out
+    );
+}
+
+#define MB_FILTER_CHUNK 256
+
+// With a filter, each chunk of queries is first tested against
+// it (with the blocks prefetched a chunk ahead of the tests) and 
+// only the survivors are searched.
+static void mb_find_many(
+    const mb_view* mb, const uint64_t* queries, size_t M, int64_t* out
+) {
+    if (mb->filter == NULL || mb->N == 0) {
+        mb_search_many(mb, queries, M, out);
+        return;
+    }
+
+    uint64_t h[MB_FILTER_CHUNK];
+    uint64_t candidates[MB_FILTER_CHUNK];
+    uint32_t members[MB_FILTER_CHUNK];
+    int64_t found[MB_FILTER_CHUNK];
+
+    for (size_t start = 0; start < M; start += MB_FILTER_CHUNK) {
+        size_t count = M - start;
+        if (count > MB_FILTER_CHUNK) {
+            count = MB_FILTER_CHUNK;
+        }
+
+        for (size_t j = 0; j < count; j++) {
+            h[j] = mb_hash_mix(queries[start + j] ^ MB_BLOOM_SEED);
+            MB_PREFETCH(mb_bloom_block(mb->filter, mb->filter_blocks, h[j]));
+        }
+
+        size_t survivors = 0;
+        for (size_t j = 0; j < count; j++) {
+            out[start + j] = -1;
+            if (mb_bloom_test(mb_bloom_block(mb->filter, mb->filter_blocks, h[j]), h[j])) {
+                candidates[survivors] = queries[start + j];
+                members[survivors] = (uint32_t)j;
+                survivors++;
+            }
+        }
+
+        if (survivors > 0) {
+            mb_search_many(mb, candidates, survivors, found);
+            for (size_t j = 0; j < survivors; j++) {
+                out[start + members[j]] = found[j];
+            }
+        }
+    }
+}
+
+// The byte range [start, end) of the value at index position k.
+// A value ends where the next begins (or the buffer ends) less 
+// its padding. Returns -1 if the range is out of bounds.
+static inline int mb_value_range(
+    const mb_view* mb, size_t k, uint64_t* start, uint64_t* end
+) {
+    *start = mb_element(mb->offsets, mb->offset_width, k * mb->stride);
+    *end = (k + 1 < mb->N) 
+        ? mb_element(mb->offsets, mb->offset_width, (k + 1) * mb->stride)
+        : (uint64_t)mb->len;
+
+    if (*start > *end || *end > (uint64_t)mb->len) {
+        return -1;
+    }
+    if (mb->padding != NULL) {
+        if (mb->padding[k] > *end - *start) {
+            return -1;
+        }
+        *end -= mb->padding[k];
+    }
+    return 0;
+}
+
+// Returns either a zero-copy memoryview or a bytes copy of 
+// the value stored at index position k.
+static PyObject* mb_value(PyObject* base, mb_view* mb, size_t k, int view) {
+    uint64_t start, end;
+    if (mb_value_range(mb, k, &start, &end) < 0) {
+        PyErr_SetString(PyExc_ValueError, "Index offsets are out of range for the buffer.");
+        return NULL;
+    }
+
+    if (!view) {
+        return PyBytes_FromStringAndSize(
+            (const char*)(mb->buf + start), (Py_ssize_t)(end - start)
+        );
+    }
+
+    PyObject* py_start = PyLong_FromUnsignedLongLong(start);
+    PyObject* py_end = PyLong_FromUnsignedLongLong(end);
+    PyObject* slice = NULL;
+    if (py_start != NULL && py_end != NULL) {
+        slice = PySlice_New(py_start, py_end, NULL);
+    }
+    Py_XDECREF(py_start);
+    Py_XDECREF(py_end);
+    if (slice == NULL) {
+        return NULL;
+    }
+    PyObject* value = PyObject_GetItem(base, slice);
+    Py_DECREF(slice);
+    return value;
+}
+
+// Converts key into a label. Returns 1 on success, 0 if key is
+// an integer that can't be a label (so it is simply missing),
+// or -1 with an exception set.
+static int mb_label(PyObject* key, uint64_t* label) {
+    PyObject* index = PyNumber_Index(key);
+    if (index == NULL) {
+        return -1;
+    }
+    unsigned long long value = PyLong_AsUnsignedLongLong(index);
+    Py_DECREF(index);
+    if (value == (unsigned long long)-1 && PyErr_Occurred()) {
+        if (PyErr_ExceptionMatches(PyExc_OverflowError)) {
+            PyErr_Clear();
+            return 0;
+        }
+        return -1;
+    }
+    *label = (uint64_t)value;
+    return 1;
+}
+
+static PyObject* find_index_position(PyObject* self, PyObject *args) {
+    Py_buffer buffer;
+    PyObject* key;
+
+    if (!PyArg_ParseTuple(args, "y*O", &buffer, &key)) {
+        return NULL;
+    }
+
+    mb_view mb;
+    if (mb_parse((unsigned char*)buffer.buf, (size_t)buffer.len, &mb) < 0) {
+        PyBuffer_Release(&buffer);
+        return NULL;
+    }
+
+    uint64_t label = 0;
+    int status = mb_label(key, &label);
+    if (status < 0) {
+        PyBuffer_Release(&buffer);
+        return NULL;
+    }
+
+    int64_t k = -1;
+    if (status > 0 && mb.N > 0) {
+        MB_BEGIN_ALLOW_THREADS_IF(mb_release_gil_for_search(mb.N, mb.label_width, mb.stride))
+        k = mb_find(&mb, (uint64_t)label);
+        MB_END_ALLOW_THREADS_IF
+    }
+
+    PyBuffer_Release(&buffer);
+    return PyLong_FromLongLong(k);
+}
+
+static PyObject* find_index_positions(PyObject* self, PyObject *args) {
+    Py_buffer buffer;
+    Py_buffer labels;
+    Py_buffer out;
+
+    if (!PyArg_ParseTuple(args, "y*y*w*", &buffer, &labels, &out)) {
+        return NULL;
+    }
+
+    PyObject* result = NULL;
+    size_t M = (size_t)labels.len / 8;
+    mb_view mb;
+
+    if (mb_parse((unsigned char*)buffer.buf, (size_t)buffer.len, &mb) < 0) {
+        goto done;
+    }
+
+    if ((size_t)out.len < M * 8) {
+        PyErr_SetString(PyExc_ValueError, "Output buffer must have room for one int64 per label.");
+        goto done;
+    }
+
+    MB_BEGIN_ALLOW_THREADS_IF(M >= MB_GIL_MIN_BATCH)
+    mb_find_many(&mb, (uint64_t*)labels.buf, M, (int64_t*)out.buf);
+    MB_END_ALLOW_THREADS_IF
+    result = Py_None;
+    Py_INCREF(result);
+
+done:
+    PyBuffer_Release(&buffer);
+    PyBuffer_Release(&labels);
+    PyBuffer_Release(&out);
+    return result;
+}
+
+static PyObject* getvalue(PyObject* self, PyObject *args) {
+    PyObject* obj;
+    PyObject* key;
+    int view = 0;
+
+    if (!PyArg_ParseTuple(args, "OO|p", &obj, &key, &view)) {
+        return NULL;
+    }
+
+    uint64_t label = 0;
+    int status = mb_label(key, &label);
+    if (status < 0) {
+        return NULL;
+    }
+
+    Py_buffer buffer;
+    if (PyObject_GetBuffer(obj, &buffer, PyBUF_SIMPLE) < 0) {
+        return NULL;
+    }
+
+    PyObject* result = NULL;
+    PyObject* base = NULL;
+    mb_view mb;
+
+    if (mb_parse((unsigned char*)buffer.buf, (size_t)buffer.len, &mb) < 0) {
+        goto done;
+    }
+
+    int64_t k = -1;
+    if (status > 0 && mb.N > 0) {
+        MB_BEGIN_ALLOW_THREADS_IF(mb_release_gil_for_search(mb.N, mb.label_width, mb.stride))
+        k = mb_find(&mb, (uint64_t)label);
+        MB_END_ALLOW_THREADS_IF
+    }
+
+    if (k < 0) {
+        result = Py_None;
+        Py_INCREF(result);
+        goto done;
+    }
+
+    if (view && (base = PyMemoryView_FromObject(obj)) == NULL) {
+        goto done;
+    }
+    result = mb_value(base, &mb, (size_t)k, view);
+
+done:
+    Py_XDECREF(base);
+    PyBuffer_Release(&buffer);
+    return result;
+}
+
+static PyObject* getvalues(PyObject* self, PyObject *args) {
+    PyObject* obj;
+    Py_buffer labels;
+    int view = 0;
+
+    if (!PyArg_ParseTuple(args, "Oy*|p", &obj, &labels, &view)) {
+        return NULL;
+    }
+
+    Py_buffer buffer;
+    if (PyObject_GetBuffer(obj, &buffer, PyBUF_SIMPLE) < 0) {
+        PyBuffer_Release(&labels);
+        return NULL;
+    }
+
+    PyObject* result = NULL;
+    PyObject* base = NULL;
+    int64_t* positions = NULL;
+    size_t M = (size_t)labels.len / 8;
+    mb_view mb;
+
+    if (mb_parse((unsigned char*)buffer.buf, (size_t)buffer.len, &mb) < 0) {
+        goto done;
+    }
+
+    positions = (int64_t*)PyMem_Malloc((M + 1) * sizeof(int64_t));
+    if (positions == NULL) {
+        PyErr_NoMemory();
+        goto done;
+    }
+    MB_BEGIN_ALLOW_THREADS_IF(M >= MB_GIL_MIN_BATCH)
+    mb_find_many(&mb, (uint64_t*)labels.buf, M, positions);
+    MB_END_ALLOW_THREADS_IF
+
+    if (view && (base = PyMemoryView_FromObject(obj)) == NULL) {
+        goto done;
+    }
+
+    result = PyList_New((Py_ssize_t)M);
+    if (result == NULL) {
+        goto done;
+    }
+
+    for (size_t i = 0; i < M; i++) {
+        PyObject* value;
+        if (positions[i] < 0) {
+            value = Py_None;
+            Py_INCREF(value);
+        }
+        else {
+            value = mb_value(base, &mb, (size_t)positions[i], view);
+            if (value == NULL) {
+                Py_CLEAR(result);
+                goto done;
+            }
+        }
+        PyList_SET_ITEM(result, (Py_ssize_t)i, value);
+    }
+
+done:
+    PyMem_Free(positions);
+    Py_XDECREF(base);
+    PyBuffer_Release(&buffer);
+    PyBuffer_Release(&labels);
+    return result;
+}
+
+// In order traversal of an N element Eytzinger tree without 
+// recursion. The first node is the leftmost leaf. The successor 
+// of node k is the leftmost node of its right subtree or, if it 
+// has none, the node reached by undoing the run of right turns 
+// that led to k (k >> ffs(~k)).
+static inline uint64_t mb_eytzinger_leftmost(uint64_t k, size_t N) {
+    while (2 * k <= (uint64_t)N) {
+        k = 2 * k;
+    }
+    return k;
+}
+
+static inline uint64_t mb_eytzinger_next(uint64_t k, size_t N) {
+    if (2 * k + 1 <= (uint64_t)N) {
+        return mb_eytzinger_leftmost(2 * k + 1, N);
+    }
+    return k >> mb_ffs(~k);
+}
+
+static PyObject* eytzinger_sort(PyObject* self, PyObject *args) {
+    Py_buffer input;
+    Py_buffer output;
+
+    if (!PyArg_ParseTuple(args, "y*w*", &input, &output)) {
+        return NULL;
+    }
+
+    size_t N = (size_t)input.len / 8;
+
+    if ((size_t)output.len < N * 8) {
+        PyBuffer_Release(&input);
+        PyBuffer_Release(&output);
+        PyErr_SetString(PyExc_ValueError, "Output buffer must be at least as large as the input.");
+        return NULL;
+    }
+
+    uint64_t* in = (uint64_t*)input.buf;
+    uint64_t* out = (uint64_t*)output.buf;
+
+    MB_BEGIN_ALLOW_THREADS_IF(N >= MB_GIL_MIN_BATCH)
+    uint64_t k = mb_eytzinger_leftmost(1, N);
+    for (size_t i = 0; i < N; i++) {
+        out[k - 1] = in[i];
+        k = mb_eytzinger_next(k, N);
+    }
+    MB_END_ALLOW_THREADS_IF
+
+    PyBuffer_Release(&input);
+    PyBuffer_Release(&output);
+    return PyLong_FromSize_t(N);
+}
+
+// Builds the index columns from ascending labels and the byte
+// length of each label's value in a single traversal. Writes the 
+// Eytzinger ordered labels, the offset of each value (the data 
+// region is written in index order starting at first_offset), 
+// and order, the ascending rank of the label at each index 
+// position, which tells the caller how to lay out the data region.
+static PyObject* eytzinger_index(PyObject* self, PyObject *args) {
+    Py_buffer sorted_labels;
+    Py_buffer lengths;
+    unsigned long long first_offset;
+    Py_buffer labels_out;
+    Py_buffer offsets_out;
+    Py_buffer order_out;
+
+    if (!PyArg_ParseTuple(args, "y*y*Kw*w*w*", 
+        &sorted_labels, &lengths, &first_offset, 
+        &labels_out, &offsets_out, &order_out)) {
+        return NULL;
+    }
+
+    size_t N = (size_t)sorted_labels.len / 8;
+    PyObject* result = NULL;
+
+    if ((size_t)lengths.len < N * 8 
+        || (size_t)labels_out.len < N * 8
+        || (size_t)offsets_out.len < N * 8
+        || (size_t)order_out.len < N * 8) {
+        PyErr_SetString(PyExc_ValueError, "Lengths and output buffers must have one uint64 per label.");
+        goto done;
+    }
+
+    uint64_t* in = (uint64_t*)sorted_labels.buf;
+    uint64_t* len = (uint64_t*)lengths.buf;
+    uint64_t* labels = (uint64_t*)labels_out.buf;
+    uint64_t* offsets = (uint64_t*)offsets_out.buf;
+    uint64_t* order = (uint64_t*)order_out.buf;
+
+    MB_BEGIN_ALLOW_THREADS_IF(N >= MB_GIL_MIN_BATCH)
+    // offsets temporarily holds each position's value length
+    uint64_t k = mb_eytzinger_leftmost(1, N);
+    for (size_t i = 0; i < N; i++) {
+        labels[k - 1] = in[i];
+        offsets[k - 1] = len[i];
+        order[k - 1] = (uint64_t)i;
+        k = mb_eytzinger_next(k, N);
+    }
+
+    uint64_t offset = (uint64_t)first_offset;
+    for (size_t j = 0; j < N; j++) {
+        uint64_t length = offsets[j];
+        offsets[j] = offset;
+        offset += length;
+    }
+    MB_END_ALLOW_THREADS_IF
+
+    result = Py_None;
+    Py_INCREF(result);
+
+done:
+    PyBuffer_Release(&sorted_labels);
+    PyBuffer_Release(&lengths);
+    PyBuffer_Release(&labels_out);
+    PyBuffer_Release(&offsets_out);
+    PyBuffer_Release(&order_out);
+    return result;
+}
+
+static PyObject* crc32c(PyObject* self, PyObject *args) {
+    Py_buffer data;
+    unsigned int value = 0;
+
+    if (!PyArg_ParseTuple(args, "y*|I", &data, &value)) {
+        return NULL;
+    }
+
+    uint32_t crc;
+    MB_BEGIN_ALLOW_THREADS_IF(data.len >= 4096)
+    crc = mb_crc32c(
+        (uint32_t)value, (const unsigned char*)data.buf, (size_t)data.len
+    );
+    MB_END_ALLOW_THREADS_IF
+    PyBuffer_Release(&data);
+    return PyLong_FromUnsignedLong(crc);
+}
+
+// Writes the CRC32C of each buffer in a sequence into a
+// uint32 array.
+static PyObject* crc32c_many(PyObject* self, PyObject *args) {
+    PyObject* values;
+    Py_buffer out;
+
+    if (!PyArg_ParseTuple(args, "Ow*", &values, &out)) {
+        return NULL;
+    }
+
+    PyObject* result = NULL;
+    PyObject* seq = PySequence_Fast(values, "values must be a sequence of bytes.");
+    if (seq == NULL) {
+        goto done;
+    }
+
+    Py_ssize_t M = PySequence_Fast_GET_SIZE(seq);
+    if (out.len < M * 4) {
+        PyErr_SetString(PyExc_ValueError, "Output buffer must have room for one uint32 per value.");
+        goto done;
+    }
+
+    uint32_t* crcs = (uint32_t*)out.buf;
+    PyObject** items = PySequence_Fast_ITEMS(seq);
+    for (Py_ssize_t i = 0; i < M; i++) {
+        Py_buffer value;
+        if (PyObject_GetBuffer(items[i], &value, PyBUF_SIMPLE) < 0) {
+            goto done;
+        }
+        crcs[i] = mb_crc32c(0, (const unsigned char*)value.buf, (size_t)value.len);
+        PyBuffer_Release(&value);
+    }
+
+    result = Py_None;
+    Py_INCREF(result);
+
+done:
+    Py_XDECREF(seq);
+    PyBuffer_Release(&out);
+    return result;
+}
+
+// Checks in one pass over the index that the labels are
+// strictly ascending in Eytzinger order, that the hash index
+// (if any) resolves every label to its own position, that the
+// filter (if any) admits every label and, optionally, that the
+// offsets are ascending within the buffer (leaving room for
+// each value's padding) and that each value matches its
+// checksum. Returns NULL if the buffer is sound, otherwise the
+// reason ("order", "hash", "filter", "offsets", or "checksum")
+// with the index position in *position.
+static const char* mb_validate(
+    const mb_view* mb, int check_offsets, int check_checksums, int64_t* position
+) {
+    size_t N = mb->N;
+
+    uint64_t k = mb_eytzinger_leftmost(1, N);
+    for (size_t i = 0; i < N; i++) {
+        uint64_t next = mb_eytzinger_next(k, N);
+        if (i + 1 < N 
+            && mb_element(mb->labels, mb->label_width, (k - 1) * mb->stride)
+               >= mb_element(mb->labels, mb->label_width, (next - 1) * mb->stride)) {
+            *position = (int64_t)(next - 1);
+            return "order";
+        }
+        k = next;
+    }
+
+    if (mb->hash_slots != NULL) {
+        for (size_t i = 0; i < N; i++) {
+            uint64_t label = mb_element(mb->labels, mb->label_width, i * mb->stride);
+            if (mb_hash_find(mb, label) != (int64_t)i) {
+                *position = (int64_t)i;
+                return "hash";
+            }
+        }
+    }
+
+    if (mb->filter != NULL) {
+        for (size_t i = 0; i < N; i++) {
+            uint64_t label = mb_element(mb->labels, mb->label_width, i * mb->stride);
+            if (!mb_bloom_contains(mb->filter, mb->filter_blocks, label)) {
+                *position = (int64_t)i;
+                return "filter";
+            }
+        }
+    }
+
+    if (!check_offsets) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < N; i++) {
+        uint64_t start, end;
+        if (mb_value_range(mb, i, &start, &end) < 0) {
+            *position = (int64_t)i;
+            return "offsets";
+        }
+    }
+
+    if (check_checksums && mb->checksums != NULL) {
+        for (size_t i = 0; i < N; i++) {
+            uint64_t start, end;
+            mb_value_range(mb, i, &start, &end);
+            uint32_t crc = mb_crc32c(0, mb->buf + start, (size_t)(end - start));
+            if (crc != mb->checksums[i]) {
+                *position = (int64_t)i;
+                return "checksum";
+            }
+        }
+    }
+
+    return NULL;
+}
+
+// Returns None if the buffer is sound, otherwise 
+// (reason, index position). See mb_validate.
+static PyObject* validate(PyObject* self, PyObject *args) {
+    Py_buffer buffer;
+    int check_offsets = 1;
+    int check_checksums = 1;
+
+    if (!PyArg_ParseTuple(args, "y*|pp", &buffer, &check_offsets, &check_checksums)) {
+        return NULL;
+    }
+
+    mb_view mb;
+    if (mb_parse((unsigned char*)buffer.buf, (size_t)buffer.len, &mb) < 0) {
+        PyBuffer_Release(&buffer);
+        return NULL;
+    }
+
+    const char* reason = NULL;
+    int64_t position = -1;
+    MB_BEGIN_ALLOW_THREADS_IF(mb.N >= MB_GIL_MIN_BATCH)
+    reason = mb_validate(&mb, check_offsets, check_checksums, &position);
+    MB_END_ALLOW_THREADS_IF
+
+    PyBuffer_Release(&buffer);
+    if (reason == NULL) {
+        Py_RETURN_NONE;
+    }
+    return Py_BuildValue("(sL)", reason, (long long)position);
+}
+
+#define MB_HASH_MAX_PILOT (1u << 20)
+#define MB_HASH_ATTEMPTS 16
+
+// Places the buckets of one seed largest first, searching for 
+// each the smallest pilot that sends all its labels to distinct
+// free slots. Returns 0 on success or -1 if some bucket found 
+// no pilot below MB_HASH_MAX_PILOT.
+static int mb_hash_place(
+    const uint64_t* labels, size_t N, uint64_t seed,
+    uint32_t* pilots, size_t buckets, uint32_t* slots, size_t size,
+    uint64_t* hashes, uint32_t* bucket_start, uint32_t* members, 
+    uint32_t* order, uint64_t* candidates
+) {
+    for (size_t s = 0; s < size; s++) {
+        slots[s] = MB_HASH_EMPTY;
+    }
+    memset(pilots, 0, buckets * sizeof(uint32_t));
+    memset(bucket_start, 0, (buckets + 1) * sizeof(uint32_t));
+
+    // counting sort of the labels by bucket
+    for (size_t i = 0; i < N; i++) {
+        hashes[i] = mb_hash_mix(labels[i] ^ seed);
+        bucket_start[mb_hash_bucket(hashes[i], buckets) + 1]++;
+    }
+    size_t max_bucket = 0;
+    for (size_t b = 0; b < buckets; b++) {
+        if (bucket_start[b + 1] > max_bucket) {
+            max_bucket = bucket_start[b + 1];
+        }
+        bucket_start[b + 1] += bucket_start[b];
+    }
+    for (size_t i = 0; i < N; i++) {
+        size_t b = mb_hash_bucket(hashes[i], buckets);
+        members[bucket_start[b]++] = (uint32_t)i;
+    }
+    for (size_t b = buckets; b > 0; b--) {
+        bucket_start[b] = bucket_start[b - 1];
+    }
+    bucket_start[0] = 0;
+
+    // buckets by descending size, again by counting sort, 
+    // with the candidate slots buffer used for the counts
+    memset(candidates, 0, (max_bucket + 2) * sizeof(uint64_t));
+    for (size_t b = 0; b < buckets; b++) {
+        candidates[max_bucket - (bucket_start[b + 1] - bucket_start[b]) + 1]++;
+    }
+    for (size_t j = 0; j <= max_bucket; j++) {
+        candidates[j + 1] += candidates[j];
+    }
+    for (size_t b = 0; b < buckets; b++) {
+        order[candidates[max_bucket - (bucket_start[b + 1] - bucket_start[b])]++] = (uint32_t)b;
+    }
+
+    for (size_t j = 0; j < buckets; j++) {
+        uint32_t b = order[j];
+        uint32_t first = bucket_start[b];
+        uint32_t count = bucket_start[b + 1] - first;
+        if (count == 0) {
+            break; // the rest are empty too
+        }
+
+        uint32_t pilot = 0;
+        for (; pilot < MB_HASH_MAX_PILOT; pilot++) {
+            uint32_t m = 0;
+            for (; m < count; m++) {
+                uint64_t slot = mb_hash_slot(hashes[members[first + m]], pilot, size);
+                if (slots[slot] != MB_HASH_EMPTY) {
+                    break;
+                }
+                uint32_t n = 0;
+                while (n < m && candidates[n] != slot) {
+                    n++;
+                }
+                if (n < m) {
+                    break;
+                }
+                candidates[m] = slot;
+            }
+            if (m == count) {
+                break;
+            }
+        }
+        if (pilot == MB_HASH_MAX_PILOT) {
+            return -1;
+        }
+
+        pilots[b] = pilot;
+        for (uint32_t m = 0; m < count; m++) {
+            slots[candidates[m]] = members[first + m];
+        }
+    }
+
+    return 0;
+}
+
+// Builds the perfect hash of N distinct labels given in index 
+// order, trying new seeds until every bucket can be placed.
+static PyObject* build_hash_index(PyObject* self, PyObject *args) {
+    Py_buffer labels;
+    Py_buffer pilots;
+    Py_buffer slots;
+
+    if (!PyArg_ParseTuple(args, "y*w*w*", &labels, &pilots, &slots)) {
+        return NULL;
+    }
+
+    PyObject* result = NULL;
+    size_t N = (size_t)labels.len / 8;
+    size_t buckets = mb_hash_buckets(N);
+    size_t size = mb_hash_size(N);
+    uint64_t* hashes = NULL;
+    uint32_t* bucket_start = NULL;
+    uint32_t* members = NULL;
+    uint32_t* order = NULL;
+    uint64_t* candidates = NULL;
+
+    if ((uint64_t)size > 0xffffffffULL) {
+        PyErr_SetString(PyExc_ValueError, "Too many labels for a hash index.");
+        goto done;
+    }
+    if ((size_t)pilots.len < buckets * 4 || (size_t)slots.len < size * 4) {
+        PyErr_Format(PyExc_ValueError, 
+            "A hash index of %zu labels needs %zu uint32 pilots and %zu uint32 slots.",
+            N, buckets, size
+        );
+        goto done;
+    }
+
+    hashes = (uint64_t*)PyMem_Malloc((N + 1) * sizeof(uint64_t));
+    bucket_start = (uint32_t*)PyMem_Malloc((buckets + 1) * sizeof(uint32_t));
+    members = (uint32_t*)PyMem_Malloc((N + 1) * sizeof(uint32_t));
+    order = (uint32_t*)PyMem_Malloc(buckets * sizeof(uint32_t));
+    // holds the bucket size counts too, sizes are at most N
+    candidates = (uint64_t*)PyMem_Malloc((N + 2) * sizeof(uint64_t));
+    if (hashes == NULL || bucket_start == NULL || members == NULL 
+        || order == NULL || candidates == NULL) {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    int status = -1;
+    uint64_t seed = 0;
+    MB_BEGIN_ALLOW_THREADS_IF(N >= MB_GIL_MIN_BATCH)
+    for (uint64_t attempt = 0; attempt < MB_HASH_ATTEMPTS && status < 0; attempt++) {
+        seed = mb_hash_mix(attempt + 1);
+        status = mb_hash_place(
+            (const uint64_t*)labels.buf, N, seed,
+            (uint32_t*)pilots.buf, buckets, (uint32_t*)slots.buf, size,
+            hashes, bucket_start, members, order, candidates
+        );
+    }
+    MB_END_ALLOW_THREADS_IF
+
+    if (status < 0) {
+        PyErr_SetString(PyExc_ValueError, "Unable to build a hash index. Are the labels distinct?");
+        goto done;
+    }
+    result = PyLong_FromUnsignedLongLong(seed);
+
+done:
+    PyMem_Free(hashes);
+    PyMem_Free(bucket_start);
+    PyMem_Free(members);
+    PyMem_Free(order);
+    PyMem_Free(candidates);
+    PyBuffer_Release(&labels);
+    PyBuffer_Release(&pilots);
+    PyBuffer_Release(&slots);
+    return result;
+}
+
+// Sets the bits of each label in a zeroed Bloom filter of
+// mb_bloom_blocks(N) blocks. Returns the number of blocks.
+static PyObject* build_bloom_filter(PyObject* self, PyObject *args) {
+    Py_buffer labels;
+    Py_buffer filter;
+
+    if (!PyArg_ParseTuple(args, "y*w*", &labels, &filter)) {
+        return NULL;
+    }
+
+    size_t N = (size_t)labels.len / 8;
+    size_t blocks = mb_bloom_blocks(N);
+    if ((size_t)filter.len < blocks * 64) {
+        PyErr_Format(PyExc_ValueError, "A filter of %zu labels needs %zu bytes.", N, blocks * 64);
+        PyBuffer_Release(&labels);
+        PyBuffer_Release(&filter);
+        return NULL;
+    }
+
+    MB_BEGIN_ALLOW_THREADS_IF(N >= MB_GIL_MIN_BATCH)
+    const uint64_t* x = (const uint64_t*)labels.buf;
+    uint64_t* bits = (uint64_t*)filter.buf;
+    for (size_t i = 0; i < N; i++) {
+        uint64_t h = mb_hash_mix(x[i] ^ MB_BLOOM_SEED);
+        mb_bloom_set(bits + MB_BLOOM_BLOCK_WORDS * mb_hash_bucket(h, blocks), h);
+    }
+    MB_END_ALLOW_THREADS_IF
+
+    PyBuffer_Release(&labels);
+    PyBuffer_Release(&filter);
+    return PyLong_FromSize_t(blocks);
+}
+
+// Tests labels against a filter section on its own (e.g. fetched
+// from a remote file ahead of the index). out[i] is 1 when 
+// labels[i] may be present and 0 when it is certainly missing.
+static PyObject* bloom_filter_contains(PyObject* self, PyObject *args) {
+    Py_buffer filter;
+    Py_buffer labels;
+    Py_buffer out;
+
+    if (!PyArg_ParseTuple(args, "y*y*w*", &filter, &labels, &out)) {
+        return NULL;
+    }
+
+    PyObject* result = NULL;
+    size_t blocks = (size_t)filter.len / 64;
+    size_t M = (size_t)labels.len / 8;
+
+    if (blocks == 0 || (size_t)filter.len % 64 != 0) {
+        PyErr_SetString(PyExc_ValueError, "A filter is a positive number of 64 byte blocks.");
+        goto done;
+    }
+    if ((size_t)out.len < M) {
+        PyErr_SetString(PyExc_ValueError, "Output buffer must have room for one uint8 per label.");
+        goto done;
+    }
+
+    MB_BEGIN_ALLOW_THREADS_IF(M >= MB_GIL_MIN_BATCH)
+    const uint64_t* x = (const uint64_t*)labels.buf;
+    uint8_t* o = (uint8_t*)out.buf;
+    for (size_t i = 0; i < M; i++) {
+        o[i] = (uint8_t)mb_bloom_contains((const uint64_t*)filter.buf, blocks, x[i]);
+    }
+    MB_END_ALLOW_THREADS_IF
+    result = Py_None;
+    Py_INCREF(result);
+
+done:
+    PyBuffer_Release(&filter);
+    PyBuffer_Release(&labels);
+    PyBuffer_Release(&out);
+    return result;
+}
+
+// Writes the index positions of an N element Eytzinger tree
+// in ascending label order.
+static PyObject* eytzinger_inorder(PyObject* self, PyObject *args) {
+    Py_buffer output;
+
+    if (!PyArg_ParseTuple(args, "w*", &output)) {
+        return NULL;
+    }
+
+    size_t N = (size_t)output.len / 8;
+    uint64_t* out = (uint64_t*)output.buf;
+
+    MB_BEGIN_ALLOW_THREADS_IF(N >= MB_GIL_MIN_BATCH)
+    uint64_t k = mb_eytzinger_leftmost(1, N);
+    for (size_t i = 0; i < N; i++) {
+        out[i] = k - 1;
+        k = mb_eytzinger_next(k, N);
+    }
+    MB_END_ALLOW_THREADS_IF
+
+    PyBuffer_Release(&output);
+    return PyLong_FromSize_t(N);
+}
+
+// Writes the labels of a mapbuffer (any format or column width)
+// into out as uint64 in ascending order.
+static PyObject* sorted_labels(PyObject* self, PyObject *args) {
+    Py_buffer buffer;
+    Py_buffer output;
+
+    if (!PyArg_ParseTuple(args, "y*w*", &buffer, &output)) {
+        return NULL;
+    }
+
+    PyObject* result = NULL;
+    mb_view mb;
+    if (mb_parse((unsigned char*)buffer.buf, (size_t)buffer.len, &mb) < 0) {
+        goto done;
+    }
+
+    if ((size_t)output.len < mb.N * sizeof(uint64_t)) {
+        PyErr_SetString(PyExc_ValueError, "Output buffer must have room for one uint64 per label.");
+        goto done;
+    }
+
+    uint64_t* out = (uint64_t*)output.buf;
+    MB_BEGIN_ALLOW_THREADS_IF(mb.N >= MB_GIL_MIN_BATCH)
+    uint64_t k = mb_eytzinger_leftmost(1, mb.N);
+    for (size_t i = 0; i < mb.N; i++) {
+        out[i] = mb_element(mb.labels, mb.label_width, (k - 1) * mb.stride);
+        k = mb_eytzinger_next(k, mb.N);
+    }
+    MB_END_ALLOW_THREADS_IF
+    result = PyLong_FromSize_t(mb.N);
+
+done:
+    PyBuffer_Release(&buffer);
+    PyBuffer_Release(&output);
+    return result;
+}
+
+// Position of the first node (1-based) in an Eytzinger tree 
+// whose label is >= x, or 0 if every label is less than x.
+static inline uint64_t mb_eytzinger_lower_bound(
+    uint64_t x, const void* labels, size_t width, size_t stride, size_t N
+) {
+    uint64_t k = 1;
+    while (k <= (uint64_t)N) {
+        k = 2 * k + (mb_element(labels, width, (k - 1) * stride) < x);
+    }
+    return k >> mb_ffs(~k);
+}
+
+// Returns the index positions (as bytes of uint64) of the labels
+// in [lo, hi) in ascending label order. The range is found with
+// a single descent and then walked in order, so the cost is 
+// proportional to log N plus the number of labels returned.
+static PyObject* range_positions(PyObject* self, PyObject *args) {
+    Py_buffer buffer;
+    unsigned long long lo;
+    unsigned long long hi;
+    int bounded = 1;
+    unsigned long long limit = 0;
+
+    if (!PyArg_ParseTuple(args, "y*KK|pK", &buffer, &lo, &hi, &bounded, &limit)) {
+        return NULL;
+    }
+
+    PyObject* result = NULL;
+    mb_view mb;
+    if (mb_parse((unsigned char*)buffer.buf, (size_t)buffer.len, &mb) < 0) {
+        goto done;
+    }
+
+    uint64_t first = 0;
+    size_t count = 0;
+    uint64_t k = 0;
+
+    MB_BEGIN_ALLOW_THREADS_IF(mb.N >= MB_GIL_MIN_BATCH)
+    if (mb.N > 0) {
+        first = mb_eytzinger_lower_bound(
+            (uint64_t)lo, mb.labels, mb.label_width, mb.stride, mb.N
+        );
+    }
+
+    // counted first so that the output is allocated once
+    k = first;
+    while (k > 0 && (limit == 0 || count < (size_t)limit)) {
+        if (bounded && mb_element(mb.labels, mb.label_width, (k - 1) * mb.stride) >= (uint64_t)hi) {
+            break;
+        }
+        count++;
+        k = mb_eytzinger_next(k, mb.N);
+    }
+    MB_END_ALLOW_THREADS_IF
+
+    result = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)(count * sizeof(uint64_t)));
+    if (result == NULL) {
+        goto done;
+    }
+
+    uint64_t* out = (uint64_t*)PyBytes_AS_STRING(result);
+    MB_BEGIN_ALLOW_THREADS_IF(count >= MB_GIL_MIN_BATCH)
+    k = first;
+    for (size_t i = 0; i < count; i++) {
+        out[i] = k - 1;
+        k = mb_eytzinger_next(k, mb.N);
+    }
+    MB_END_ALLOW_THREADS_IF
+
+done:
+    PyBuffer_Release(&buffer);
+    return result;
+}
+
+typedef struct {
+    uint64_t label;
+    size_t source;
+} mb_merge_head;
+
+static inline int mb_merge_less(const mb_merge_head* a, const mb_merge_head* b) {
+    return a->label < b->label 
+        || (a->label == b->label && a->source < b->source);
+}
+
+static void mb_merge_sift_down(mb_merge_head* heap, size_t n, size_t i) {
+    while (1) {
+        size_t smallest = i;
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+        if (left < n && mb_merge_less(&heap[left], &heap[smallest])) {
+            smallest = left;
+        }
+        if (right < n && mb_merge_less(&heap[right], &heap[smallest])) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            return;
+        }
+        mb_merge_head tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+// K-way merge of ascending uint64 label arrays. Every label is 
+// kept and equal labels are ordered by source so the caller can
+// resolve conflicts. Writes the merged labels, the source of 
+// each, and its rank within that source. Returns the count.
+static PyObject* merge_sorted(PyObject* self, PyObject *args) {
+    PyObject* arrays;
+    Py_buffer labels_out;
+    Py_buffer sources_out;
+    Py_buffer ranks_out;
+
+    if (!PyArg_ParseTuple(args, "Ow*w*w*", &arrays, &labels_out, &sources_out, &ranks_out)) {
+        return NULL;
+    }
+
+    PyObject* result = NULL;
+    Py_buffer* inputs = NULL;
+    size_t* cursors = NULL;
+    mb_merge_head* heap = NULL;
+    Py_ssize_t acquired = 0;
+
+    PyObject* seq = PySequence_Fast(arrays, "arrays must be a sequence of buffers.");
+    if (seq == NULL) {
+        goto done;
+    }
+
+    Py_ssize_t K = PySequence_Fast_GET_SIZE(seq);
+    inputs = (Py_buffer*)PyMem_Calloc((size_t)K + 1, sizeof(Py_buffer));
+    cursors = (size_t*)PyMem_Calloc((size_t)K + 1, sizeof(size_t));
+    heap = (mb_merge_head*)PyMem_Calloc((size_t)K + 1, sizeof(mb_merge_head));
+    if (inputs == NULL || cursors == NULL || heap == NULL) {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    size_t total = 0;
+    for (acquired = 0; acquired < K; acquired++) {
+        PyObject* item = PySequence_Fast_GET_ITEM(seq, acquired);
+        if (PyObject_GetBuffer(item, &inputs[acquired], PyBUF_SIMPLE) < 0) {
+            goto done;
+        }
+        total += (size_t)inputs[acquired].len / 8;
+    }
+
+    if ((size_t)labels_out.len < total * 8 
+        || (size_t)sources_out.len < total * 8 
+        || (size_t)ranks_out.len < total * 8) {
+        PyErr_SetString(PyExc_ValueError, "Output buffers must have room for one uint64 per label.");
+        goto done;
+    }
+
+    size_t n = 0;
+    for (Py_ssize_t j = 0; j < K; j++) {
+        if (inputs[j].len >= 8) {
+            heap[n].label = ((uint64_t*)inputs[j].buf)[0];
+            heap[n].source = (size_t)j;
+            n++;
+        }
+    }
+    for (size_t i = n / 2; i-- > 0;) {
+        mb_merge_sift_down(heap, n, i);
+    }
+
+    uint64_t* labels = (uint64_t*)labels_out.buf;
+    uint64_t* sources = (uint64_t*)sources_out.buf;
+    uint64_t* ranks = (uint64_t*)ranks_out.buf;
+
+    MB_BEGIN_ALLOW_THREADS_IF(total >= MB_GIL_MIN_BATCH)
+    for (size_t i = 0; n > 0; i++) {
+        size_t source = heap[0].source;
+        labels[i] = heap[0].label;
+        sources[i] = (uint64_t)source;
+        ranks[i] = (uint64_t)cursors[source];
+
+        cursors[source]++;
+        if (cursors[source] < (size_t)inputs[source].len / 8) {
+            heap[0].label = ((uint64_t*)inputs[source].buf)[cursors[source]];
+        }
+        else {
+            heap[0] = heap[--n];
+        }
+        mb_merge_sift_down(heap, n, 0);
+    }
+    MB_END_ALLOW_THREADS_IF
+
+    result = PyLong_FromSize_t(total);
+
+done:
+    for (Py_ssize_t j = 0; j < acquired; j++) {
+        PyBuffer_Release(&inputs[j]);
+    }
+    PyMem_Free(inputs);
+    PyMem_Free(cursors);
+    PyMem_Free(heap);
+    Py_XDECREF(seq);
+    PyBuffer_Release(&labels_out);
+    PyBuffer_Release(&sources_out);
+    PyBuffer_Release(&ranks_out);
+    return result;
+}
+
+// Locks (or unlocks) the pages of buffer[start:start+length]
+// into RAM, e.g. the index of a mmapped mapbuffer.
+static PyObject* mb_lock_range(PyObject* args, int lock) {
+    Py_buffer buffer;
+    Py_ssize_t start;
+    Py_ssize_t length;
+
+    if (!PyArg_ParseTuple(args, "y*nn", &buffer, &start, &length)) {
+        return NULL;
+    }
+
+    if (start < 0 || length < 0 || start + length > buffer.len) {
+        PyBuffer_Release(&buffer);
+        PyErr_SetString(PyExc_ValueError, "Range is outside of the buffer.");
+        return NULL;
+    }
+
+    int err = 0;
+    if (length > 0) {
+        char* addr = (char*)buffer.buf + start;
+#if defined _WIN32
+        err = lock 
+            ? !VirtualLock(addr, (SIZE_T)length)
+            : !VirtualUnlock(addr, (SIZE_T)length);
+#else
+        // mlock requires a page aligned address on some systems
+        size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+        uintptr_t page = (uintptr_t)addr & ~(uintptr_t)(page_size - 1);
+        size_t span = (size_t)length + ((uintptr_t)addr - page);
+        err = lock 
+            ? mlock((void*)page, span)
+            : munlock((void*)page, span);
+#endif
+    }
+
+    PyBuffer_Release(&buffer);
+
+    if (err) {
+#if defined _WIN32
+        return PyErr_SetFromWindowsErr(0);
+#else
+        return PyErr_SetFromErrno(PyExc_OSError);
+#endif
+    }
+
+    Py_RETURN_NONE;
+}
+
+static PyObject* mlock_range(PyObject* self, PyObject *args) {
+    return mb_lock_range(args, 1);
+}
+
+static PyObject* munlock_range(PyObject* self, PyObject *args) {
+    return mb_lock_range(args, 0);
+}
+
+// Native decompression of values for getmany. Codecs are
+// compiled in when setup.py finds their libraries:
+//   MB_HAVE_LIBDEFLATE or MB_HAVE_ZLIB: gzip
+//   MB_HAVE_ZSTD: zstd and zstd-dict
+// Output sizes are read from the gzip trailer or the zstd 
+// frame header so each value is decompressed straight into 
+// its final bytes object with the GIL released.
+#if defined MB_HAVE_LIBDEFLATE
+# include <libdeflate.h>
+# define MB_NATIVE_GZIP
+#elif defined MB_HAVE_ZLIB
+# include <zlib.h>
+# define MB_NATIVE_GZIP
+#endif
+
+#if defined MB_HAVE_ZSTD
+# include <zstd.h>
+#endif
+
+#if !defined _WIN32
+# include <pthread.h>
+# define MB_THREADS
+#endif
+
+#define MB_CODEC_NONE 0
+#define MB_CODEC_GZIP 1
+#define MB_CODEC_ZSTD 2
+// deflate expands its input at most ~1032x, so larger size
+// claims are corrupt (or hostile) and are left to the Python
+// path rather than allocated up front
+#define MB_MAX_EXPANSION 1032
+
+typedef struct {
+    const unsigned char* src;
+    size_t src_len;
+    unsigned char* dst;
+    size_t dst_len;
+} mb_decompress_job;
+
+typedef struct {
+    mb_decompress_job* jobs;
+    size_t start;
+    size_t end;
+    int codec;
+    const void* ddict;
+    int error;
+} mb_decompress_task;
+
+// Uncompressed size of a value or -1 if it can't be known
+// (or trusted) without decompressing it.
+static int64_t mb_decompressed_size(int codec, const unsigned char* src, size_t len) {
+    uint64_t max_size = (uint64_t)len * MB_MAX_EXPANSION;
+    if (codec == MB_CODEC_GZIP) {
+        // ISIZE: uncompressed size mod 2^32 (checked after decompressing)
+        if (len < 18) {
+            return -1;
+        }
+        uint32_t isize = 0;
+        memcpy(&isize, src + len - 4, sizeof(uint32_t));
+        if (isize > max_size) {
+            return -1;
+        }
+        return (int64_t)isize;
+    }
+#if defined MB_HAVE_ZSTD
+    if (codec == MB_CODEC_ZSTD) {
+        unsigned long long size = ZSTD_getFrameContentSize(src, len);
+        if (size == ZSTD_CONTENTSIZE_UNKNOWN || size == ZSTD_CONTENTSIZE_ERROR || size > max_size) {
+            return -1;
+        }
+        return (int64_t)size;
+    }
+#endif
+    return -1;
+}
+
+// Runs without the GIL.
+static void* mb_decompress_worker(void* arg) {
+    mb_decompress_task* task = (mb_decompress_task*)arg;
+    task->error = 0;
+
+#if defined MB_NATIVE_GZIP
+    if (task->codec == MB_CODEC_GZIP) {
+# if defined MB_HAVE_LIBDEFLATE
+        struct libdeflate_decompressor* d = libdeflate_alloc_decompressor();
+        if (d == NULL) {
+            task->error = 1;
+            return NULL;
+        }
+        for (size_t i = task->start; i < task->end && !task->error; i++) {
+            mb_decompress_job* job = &task->jobs[i];
+            size_t actual = 0;
+            enum libdeflate_result res = libdeflate_gzip_decompress(
+                d, job->src, job->src_len, job->dst, job->dst_len, &actual
+            );
+            task->error = (res != LIBDEFLATE_SUCCESS || actual != job->dst_len);
+        }
+        libdeflate_free_decompressor(d);
+# else
+        z_stream strm;
+        memset(&strm, 0, sizeof(z_stream));
+        if (inflateInit2(&strm, 16 + MAX_WBITS) != Z_OK) {
+            task->error = 1;
+            return NULL;
+        }
+        for (size_t i = task->start; i < task->end && !task->error; i++) {
+            mb_decompress_job* job = &task->jobs[i];
+            if (job->src_len > UINT32_MAX || job->dst_len > UINT32_MAX) {
+                task->error = 1;
+                break;
+            }
+            inflateReset(&strm);
+            strm.next_in = (Bytef*)job->src;
+            strm.avail_in = (uInt)job->src_len;
+            strm.next_out = (Bytef*)job->dst;
+            strm.avail_out = (uInt)job->dst_len;
+            int res = inflate(&strm, Z_FINISH);
+            task->error = (res != Z_STREAM_END || strm.total_out != job->dst_len);
+        }
+        inflateEnd(&strm);
+# endif
+        return NULL;
+    }
+#endif
+
+#if defined MB_HAVE_ZSTD
+    if (task->codec == MB_CODEC_ZSTD) {
+        ZSTD_DCtx* dctx = ZSTD_createDCtx();
+        if (dctx == NULL) {
+            task->error = 1;
+            return NULL;
+        }
+        for (size_t i = task->start; i < task->end && !task->error; i++) {
+            mb_decompress_job* job = &task->jobs[i];
+            size_t res = (task->ddict != NULL)
+                ? ZSTD_decompress_usingDDict(
+                    dctx, job->dst, job->dst_len, job->src, job->src_len, 
+                    (const ZSTD_DDict*)task->ddict
+                )
+                : ZSTD_decompressDCtx(dctx, job->dst, job->dst_len, job->src, job->src_len);
+            task->error = (ZSTD_isError(res) || res != job->dst_len);
+        }
+        ZSTD_freeDCtx(dctx);
+        return NULL;
+    }
+#endif
+
+    task->error = 1;
+    return NULL;
+}
+
+// Splits the jobs across up to threads threads (the calling
+// thread takes the first share). Returns nonzero on failure.
+static int mb_decompress_jobs(
+    mb_decompress_job* jobs, size_t M, int codec, 
+    const void* ddict, size_t threads
+) {
+    // below this many values per thread, threads cost more than they save
+    const size_t min_per_thread = 32;
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (threads > M / min_per_thread) {
+        threads = M / min_per_thread > 0 ? M / min_per_thread : 1;
+    }
+#if !defined MB_THREADS
+    threads = 1;
+#endif
+
+    mb_decompress_task* tasks = (mb_decompress_task*)calloc(threads, sizeof(mb_decompress_task));
+    if (tasks == NULL) {
+        return 1;
+    }
+    for (size_t t = 0; t < threads; t++) {
+        tasks[t].jobs = jobs;
+        tasks[t].start = M * t / threads;
+        tasks[t].end = M * (t + 1) / threads;
+        tasks[t].codec = codec;
+        tasks[t].ddict = ddict;
+    }
+
+    int error = 0;
+#if defined MB_THREADS
+    // tasks [1, started) run on their own threads
+    size_t started = 1;
+    pthread_t* handles = NULL;
+    if (threads > 1) {
+        handles = (pthread_t*)calloc(threads, sizeof(pthread_t));
+    }
+    if (handles != NULL) {
+        for (size_t t = 1; t < threads; t++) {
+            if (pthread_create(&handles[t], NULL, mb_decompress_worker, &tasks[t]) != 0) {
+                break;
+            }
+            started = t + 1;
+        }
+    }
+    mb_decompress_worker(&tasks[0]);
+    // the calling thread picks up tasks that couldn't start
+    for (size_t t = started; t < threads; t++) {
+        mb_decompress_worker(&tasks[t]);
+    }
+    for (size_t t = 1; t < started; t++) {
+        pthread_join(handles[t], NULL);
+    }
+    free(handles);
+#else
+    mb_decompress_worker(&tasks[0]);
+#endif
+
+    for (size_t t = 0; t < threads; t++) {
+        error |= tasks[t].error;
+    }
+    free(tasks);
+    return error;
+}
+
+// Searches a compressed mapbuffer for many labels and 
+// decompresses their values in one call. Returns a list 
+// aligned with labels (None for missing labels), or None if 
+// this buffer can't be handled natively (codec not compiled in,
+// block compression, unknown output sizes, or a decoding error)
+// in which case the caller should fall back to Python.
+static PyObject* decompress_values(PyObject* self, PyObject *args) {
+    Py_buffer buffer;
+    Py_buffer labels;
+    Py_buffer dictionary;
+    Py_ssize_t threads = 1;
+
+    if (!PyArg_ParseTuple(args, "y*y*y*|n", &buffer, &labels, &dictionary, &threads)) {
+        return NULL;
+    }
+
+    PyObject* result = NULL;
+    PyObject* list = NULL;
+    int64_t* positions = NULL;
+    mb_decompress_job* jobs = NULL;
+    const void* ddict = NULL;
+    size_t M = (size_t)labels.len / 8;
+    mb_view mb;
+
+    if (mb_parse((unsigned char*)buffer.buf, (size_t)buffer.len, &mb) < 0) {
+        goto done;
+    }
+
+    int codec = MB_CODEC_NONE;
+    const unsigned char* encoding = mb.buf + 8;
+    (void)encoding; // unused when no codecs are compiled in
+#if defined MB_NATIVE_GZIP
+    if (memcmp(encoding, "gzip", 4) == 0) {
+        codec = MB_CODEC_GZIP;
+    }
+#endif
+#if defined MB_HAVE_ZSTD
+    if (memcmp(encoding, "zstd", 4) == 0) {
+        codec = MB_CODEC_ZSTD;
+    }
+    else if (memcmp(encoding, "zdic", 4) == 0 && dictionary.len > 0) {
+        codec = MB_CODEC_ZSTD;
+        ddict = ZSTD_createDDict(dictionary.buf, (size_t)dictionary.len);
+        if (ddict == NULL) {
+            codec = MB_CODEC_NONE;
+        }
+    }
+#endif
+
+    uint64_t block_size = 0;
+    if (mb.format_version == 1) {
+        memcpy(&block_size, mb.buf + 24, sizeof(uint64_t));
+    }
+    if (codec == MB_CODEC_NONE || block_size > 0) {
+        result = Py_None;
+        Py_INCREF(result);
+        goto done;
+    }
+
+    positions = (int64_t*)PyMem_Malloc((M > 0 ? M : 1) * sizeof(int64_t));
+    jobs = (mb_decompress_job*)PyMem_Calloc((M > 0 ? M : 1), sizeof(mb_decompress_job));
+    list = PyList_New((Py_ssize_t)M);
+    if (positions == NULL || jobs == NULL || list == NULL) {
+        if (list != NULL) {
+            PyErr_NoMemory();
+        }
+        goto done;
+    }
+
+    MB_BEGIN_ALLOW_THREADS_IF(M >= MB_GIL_MIN_BATCH)
+    mb_find_many(&mb, (uint64_t*)labels.buf, M, positions);
+    MB_END_ALLOW_THREADS_IF
+
+    // output bytes objects are allocated with the GIL held
+    size_t J = 0;
+    int fallback = 0;
+    for (size_t i = 0; i < M; i++) {
+        int64_t k = positions[i];
+        if (k < 0) {
+            Py_INCREF(Py_None);
+            PyList_SET_ITEM(list, (Py_ssize_t)i, Py_None);
+            continue;
+        }
+
+        uint64_t start, end;
+        if (mb_value_range(&mb, (size_t)k, &start, &end) < 0) {
+            fallback = 1;
+            break;
+        }
+
+        const unsigned char* src = mb.buf + start;
+        int64_t size = mb_decompressed_size(codec, src, (size_t)(end - start));
+        if (size < 0) {
+            fallback = 1;
+            break;
+        }
+
+        PyObject* value = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)size);
+        if (value == NULL) {
+            goto done;
+        }
+        PyList_SET_ITEM(list, (Py_ssize_t)i, value);
+
+        jobs[J].src = src;
+        jobs[J].src_len = (size_t)(end - start);
+        jobs[J].dst = (unsigned char*)PyBytes_AS_STRING(value);
+        jobs[J].dst_len = (size_t)size;
+        J++;
+    }
+
+    if (!fallback) {
+        int error = 0;
+        MB_BEGIN_ALLOW_THREADS_IF(M >= MB_GIL_MIN_BATCH)
+        error = mb_decompress_jobs(jobs, J, codec, ddict, (size_t)(threads > 0 ? threads : 1));
+        MB_END_ALLOW_THREADS_IF
+        fallback = error;
+    }
+
+    if (fallback) {
+        result = Py_None;
+        Py_INCREF(result);
+    }
+    else {
+        result = list;
+        list = NULL;
+    }
+
+done:
+#if defined MB_HAVE_ZSTD
+    if (ddict != NULL) {
+        ZSTD_freeDDict((ZSTD_DDict*)ddict);
+    }
+#endif
+    // unfilled list slots are NULL, which Py_XDECREF of the list handles
+    Py_XDECREF(list);
+    PyMem_Free(positions);
+    PyMem_Free(jobs);
+    PyBuffer_Release(&buffer);
+    PyBuffer_Release(&labels);
+    PyBuffer_Release(&dictionary);
+    return result;
+}
+
+// Names of the codecs decompress_values handles in this build.
+static PyObject* mb_native_codecs(void) {
+    PyObject* codecs = PyList_New(0);
+    if (codecs == NULL) {
+        return NULL;
+    }
+    const char* names[3];
+    size_t n = 0;
+#if defined MB_NATIVE_GZIP
+    names[n++] = "gzip";
+#endif
+#if defined MB_HAVE_ZSTD
+    names[n++] = "zstd";
+    names[n++] = "zstd-dict";
+#endif
+    for (size_t i = 0; i < n; i++) {
+        PyObject* name = PyUnicode_FromString(names[i]);
+        if (name == NULL || PyList_Append(codecs, name) < 0) {
+            Py_XDECREF(name);
+            Py_DECREF(codecs);
+            return NULL;
+        }
+        Py_DECREF(name);
+    }
+    PyObject* result = PyList_AsTuple(codecs);
+    Py_DECREF(codecs);
+    return result;
+}
+
+// Names of the batched search kernels this CPU can run.
+static PyObject* mb_supported_search_kernels(void) {
+    PyObject* kernels = PyList_New(0);
+    if (kernels == NULL) {
+        return NULL;
+    }
+    for (size_t i = 0; i < MB_NUM_SEARCH_KERNELS; i++) {
+        if (!mb_search_kernels[i].supported) {
+            continue;
+        }
+        PyObject* name = PyUnicode_FromString(mb_search_kernels[i].name);
+        if (name == NULL || PyList_Append(kernels, name) < 0) {
+            Py_XDECREF(name);
+            Py_DECREF(kernels);
+            return NULL;
+        }
+        Py_DECREF(name);
+    }
+    PyObject* result = PyList_AsTuple(kernels);
+    Py_DECREF(kernels);
+    return result;
+}
+
+static PyObject* search_kernel(PyObject* self, PyObject* args) {
+    return PyUnicode_FromString(mb_search_kernels[mb_search_kernel_index].name);
+}
+
+static PyObject* set_search_kernel(PyObject* self, PyObject* args) {
+    const char* name;
+    if (!PyArg_ParseTuple(args, "s", &name)) {
+        return NULL;
+    }
+    for (size_t i = 0; i < MB_NUM_SEARCH_KERNELS; i++) {
+        if (strcmp(mb_search_kernels[i].name, name) != 0) {
+            continue;
+        }
+        if (!mb_search_kernels[i].supported) {
+            PyErr_Format(PyExc_ValueError, "This CPU can't run the %s search kernel.", name);
+            return NULL;
+        }
+        mb_search_kernel_index = i;
+        mb_search_many_impl = mb_search_kernels[i].fn;
+        Py_RETURN_NONE;
+    }
+    PyErr_Format(PyExc_ValueError, "Unknown search kernel: %s", name);
+    return NULL;
+}
+
+// MapBufferView holds a parsed mapbuffer and an export of its
+// buffer so that single label lookups run entirely in C 
+// without reparsing the header or going through numpy.
+typedef struct {
+    PyObject_HEAD
+    Py_buffer buffer;
+    int has_buffer;
+    // searches in progress without the GIL, which must
+    // finish before the buffer can be released
+    Py_ssize_t readers;
+    mb_view mb;
+} MapBufferViewObject;
+
+static void MapBufferView_release_buffer(MapBufferViewObject* self) {
+    if (self->has_buffer) {
+        PyBuffer_Release(&self->buffer);
+        self->has_buffer = 0;
+    }
+}
+
+static int MapBufferView_init(MapBufferViewObject* self, PyObject* args, PyObject* kwds) {
+    PyObject* obj;
+    if (!PyArg_ParseTuple(args, "O", &obj)) {
+        return -1;
+    }
+
+    // __init__ can be called again on a live view
+    if (self->readers > 0) {
+        PyErr_SetString(PyExc_BufferError, "MapBufferView is being searched by another thread.");
+        return -1;
+    }
+
+    MapBufferView_release_buffer(self);
+    if (PyObject_GetBuffer(obj, &self->buffer, PyBUF_SIMPLE) < 0) {
+        return -1;
+    }
+    self->has_buffer = 1;
+
+    if (mb_parse((unsigned char*)self->buffer.buf, (size_t)self->buffer.len, &self->mb) < 0) {
+        MapBufferView_release_buffer(self);
+        return -1;
+    }
+    // values are returned as stored
+    if (memcmp(self->mb.buf + 8, "none", 4) != 0) {
+        PyErr_SetString(PyExc_ValueError, "MapBufferView requires an uncompressed buffer.");
+        MapBufferView_release_buffer(self);
+        return -1;
+    }
+    return 0;
+}
+
+static void MapBufferView_dealloc(MapBufferViewObject* self) {
+    MapBufferView_release_buffer(self);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+// Index position of key, -1 if missing, or -2 with an exception set.
+static int64_t MapBufferView_find(MapBufferViewObject* self, PyObject* key) {
+    if (!self->has_buffer) {
+        PyErr_SetString(PyExc_ValueError, "MapBufferView has been released.");
+        return -2;
+    }
+
+    uint64_t label = 0;
+    int status = mb_label(key, &label);
+    if (status <= 0) {
+        return status - 1;
+    }
+    
+    if (self->mb.N == 0) {
+        return -1;
+    }
+
+    const mb_view* mb = &self->mb;
+    int release = mb_release_gil_for_search(mb->N, mb->label_width, mb->stride);
+    int64_t k;
+    self->readers += release;
+    MB_BEGIN_ALLOW_THREADS_IF(release)
+    k = mb_find(mb, label);
+    MB_END_ALLOW_THREADS_IF
+    self->readers -= release;
+    return k;
+}
+
+static Py_ssize_t MapBufferView_len(MapBufferViewObject* self) {
+    return self->has_buffer ? (Py_ssize_t)self->mb.N : 0;
+}
+
+static PyObject* MapBufferView_getitem(MapBufferViewObject* self, PyObject* key) {
+    int64_t k = MapBufferView_find(self, key);
+    if (k == -2) {
+        return NULL;
+    }
+    else if (k < 0) {
+        PyErr_Format(PyExc_KeyError, "%S was not found.", key);
+        return NULL;
+    }
+    return mb_value(NULL, &self->mb, (size_t)k, 0);
+}
+
+static int MapBufferView_contains(MapBufferViewObject* self, PyObject* key) {
+    int64_t k = MapBufferView_find(self, key);
+    if (k == -2) {
+        return -1;
+    }
+    return k >= 0;
+}
+
+static PyObject* MapBufferView_get(MapBufferViewObject* self, PyObject* args) {
+    PyObject* key;
+    PyObject* default_value = Py_None;
+    if (!PyArg_ParseTuple(args, "O|O", &key, &default_value)) {
+        return NULL;
+    }
+
+    int64_t k = MapBufferView_find(self, key);
+    if (k == -2) {
+        return NULL;
+    }
+    else if (k < 0) {
+        Py_INCREF(default_value);
+        return default_value;
+    }
+    return mb_value(NULL, &self->mb, (size_t)k, 0);
+}
+
+static PyObject* MapBufferView_release(MapBufferViewObject* self, PyObject* Py_UNUSED(ignored)) {
+    if (self->readers > 0) {
+        PyErr_SetString(PyExc_BufferError, "MapBufferView is being searched by another thread.");
+        return NULL;
+    }
+    MapBufferView_release_buffer(self);
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef MapBufferView_methods[] = {
+    {"get", (PyCFunction)MapBufferView_get, METH_VARARGS, "Returns the bytes stored under label or default if it is missing. Arguments: label, default=None"},
+    {"release", (PyCFunction)MapBufferView_release, METH_NOARGS, "Release the underlying buffer (e.g. so an mmap can be closed)."},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyMappingMethods MapBufferView_as_mapping = {
+    (lenfunc)MapBufferView_len,
+    (binaryfunc)MapBufferView_getitem,
+    NULL,
+};
+
+static PySequenceMethods MapBufferView_as_sequence = {
+    .sq_contains = (objobjproc)MapBufferView_contains,
+};
+
+static PyTypeObject MapBufferViewType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "mapbufferaccel.MapBufferView",
+    .tp_doc = "Read-only native lookups on a mapbuffer without compression. Arguments: buffer",
+    .tp_basicsize = sizeof(MapBufferViewObject),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = PyType_GenericNew,
+    .tp_init = (initproc)MapBufferView_init,
+    .tp_dealloc = (destructor)MapBufferView_dealloc,
+    .tp_methods = MapBufferView_methods,
+    .tp_as_mapping = &MapBufferView_as_mapping,
+    .tp_as_sequence = &MapBufferView_as_sequence,
+};
+
+static PyMethodDef mapbufferaccel_methods[] = {
+    {"eytzinger_binary_search", (PyCFunction)eytzinger_binary_search, METH_VARARGS, "Binary search on Eytzinger sorted mapbuffer index. Arguments: uint64_t label, uint64* index"},
+    {"eytzinger_binary_search_many", (PyCFunction)eytzinger_binary_search_many, METH_VARARGS, "Interleaved binary search of many labels on Eytzinger sorted mapbuffer index. Arguments: uint64* labels, uint64* index, int64* out"},
+    {"find_index_position", (PyCFunction)find_index_position, METH_VARARGS, "Search a mapbuffer (any format version) for label. Returns the index position or -1. Arguments: buffer, uint64_t label"},
+    {"find_index_positions", (PyCFunction)find_index_positions, METH_VARARGS, "Interleaved search of a mapbuffer for many labels. Arguments: buffer, uint64* labels, int64* out"},
+    {"getvalue", (PyCFunction)getvalue, METH_VARARGS, "Extract the value stored under label from a mapbuffer without compression. Returns None if missing. Arguments: buffer, uint64_t label, bool view (return a zero-copy memoryview instead of bytes)"},
+    {"getvalues", (PyCFunction)getvalues, METH_VARARGS, "Extract the values for many labels as a list (None if missing). Arguments: buffer, uint64* labels, bool view"},
+    {"eytzinger_sort", (PyCFunction)eytzinger_sort, METH_VARARGS, "Rewrite ascending uint64 labels into Eytzinger order without recursion. Arguments: uint64* input, uint64* output. Returns N."},
+    {"eytzinger_index", (PyCFunction)eytzinger_index, METH_VARARGS, "Build the Eytzinger label column, offset column, and data order from ascending labels. Arguments: uint64* sorted_labels, uint64* lengths, uint64_t first_offset, uint64* labels_out, uint64* offsets_out, uint64* order_out"},
+    {"eytzinger_inorder", (PyCFunction)eytzinger_inorder, METH_VARARGS, "Write the index positions of an Eytzinger tree in ascending label order. Arguments: uint64* out (N elements). Returns N."},
+    {"sorted_labels", (PyCFunction)sorted_labels, METH_VARARGS, "Write the labels of a mapbuffer in ascending order by in order traversal of its index. Arguments: buffer, uint64* out (N elements). Returns N."},
+    {"range_positions", (PyCFunction)range_positions, METH_VARARGS, "Index positions of the labels in [lo, hi) in ascending label order as bytes of uint64. Arguments: buffer, uint64_t lo, uint64_t hi, bool bounded (False ignores hi), uint64_t limit (0 for no limit)"},
+    {"merge_sorted", (PyCFunction)merge_sorted, METH_VARARGS, "K-way merge of ascending uint64 arrays keeping duplicates (ordered by source). Arguments: sequence of uint64* arrays, uint64* labels_out, uint64* sources_out, uint64* ranks_out. Returns the total count."},
+    {"crc32c", (PyCFunction)crc32c, METH_VARARGS, "CRC32C (Castagnoli) checksum, hardware accelerated where available. Arguments: buffer, uint32 value (to continue a running checksum)"},
+    {"crc32c_many", (PyCFunction)crc32c_many, METH_VARARGS, "Compute the CRC32C of each buffer in a sequence. Arguments: sequence of buffers, uint32* out"},
+    {"build_hash_index", (PyCFunction)build_hash_index, METH_VARARGS, "Build the perfect hash index of distinct labels in index order. Arguments: uint64* labels, uint32* pilots_out, uint32* slots_out. Returns the seed."},
+    {"build_bloom_filter", (PyCFunction)build_bloom_filter, METH_VARARGS, "Set the bits of each label in a zeroed blocked Bloom filter. Arguments: uint64* labels, uint8* filter_out. Returns the number of 64 byte blocks."},
+    {"bloom_filter_contains", (PyCFunction)bloom_filter_contains, METH_VARARGS, "Test labels against a blocked Bloom filter section. Arguments: filter bytes, uint64* labels, uint8* out (1 if possibly present)"},
+    {"validate", (PyCFunction)validate, METH_VARARGS, "Check Eytzinger label order, the hash index, the filter, offset monotonicity, and value checksums of a mapbuffer in one pass. Returns None or (reason, position). Arguments: buffer, bool check_offsets, bool check_checksums"},
+    {"decompress_values", (PyCFunction)decompress_values, METH_VARARGS, "Search a compressed mapbuffer for many labels and decompress their values with the GIL released. Returns a list (None for missing labels) or None if the buffer can't be handled natively. Arguments: buffer, uint64* labels, bytes dictionary, int threads"},
+    {"search_kernel", (PyCFunction)search_kernel, METH_NOARGS, "Name of the batched search kernel in use (see SEARCH_KERNELS)."},
+    {"set_search_kernel", (PyCFunction)set_search_kernel, METH_VARARGS, "Use another batched search kernel this CPU supports, e.g. to compare them. Not thread safe. Arguments: str name"},
+    {"mlock", (PyCFunction)mlock_range, METH_VARARGS, "Lock the pages spanning buffer[start:start+length] into RAM. Arguments: buffer, start, length"},
+    {"munlock", (PyCFunction)munlock_range, METH_VARARGS, "Unlock the pages spanning buffer[start:start+length]. Arguments: buffer, start, length"},
+    {NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef mapbufferaccel_module = {
+    PyModuleDef_HEAD_INIT,
+    "mapbufferaccel",
+    "Accelerated functions for MapBuffer.",
+    -1,
+    mapbufferaccel_methods
+};
+
+PyMODINIT_FUNC PyInit_mapbufferaccel(void) {
+    mb_prefetch_threshold = mb_cache_size();
+    mb_crc32c_init();
+    mb_search_init();
+
+    if (PyType_Ready(&MapBufferViewType) < 0) {
+        return NULL;
+    }
+
+    PyObject* module = PyModule_Create(&mapbufferaccel_module);
+    if (module == NULL) {
+        return NULL;
+    }
+
+    // codecs decompress_values supports in this build
+    if (PyModule_AddObject(module, "NATIVE_CODECS", mb_native_codecs()) < 0) {
+        Py_DECREF(module);
+        return NULL;
+    }
+
+    Py_INCREF(&MapBufferViewType);
+    if (PyModule_AddObject(module, "MapBufferView", (PyObject*)&MapBufferViewType) < 0) {
+        Py_DECREF(&MapBufferViewType);
+        Py_DECREF(module);
+        return NULL;
+    }
+
+    // batched search kernels this CPU supports, widest last
+    if (PyModule_AddObject(module, "SEARCH_KERNELS", mb_supported_search_kernels()) < 0) {
+        Py_DECREF(module);
+        return NULL;
+    }
+
+    // index size in bytes above which searches prefetch
+    if (PyModule_AddObject(module, "PREFETCH_THRESHOLD", PyLong_FromSize_t(mb_prefetch_threshold)) < 0) {
+        Py_DECREF(module);
+        return NULL;
+    }
+
+    return module;
 }
 
 #endif
\ No newline at end of file
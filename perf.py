@@ -1,47 +1,336 @@
-import pytest
-import numpy as np
-from mapbuffer import MapBuffer, HEADER_LENGTH
-import random
-import time
+"""
+Benchmarks for mapbuffer.
+
+Each scenario runs for every combination of N, value size
+distribution, and compression and emits one record per run
+as JSON lines (default) or CSV so results can be compared
+between revisions to catch regressions.
+
+Scenarios:
+  build: MapBuffer construction (dict2buf or MapBufferWriter)
+    with the Eytzinger sort and compression timed separately.
+  lookup: latency percentiles of single label lookups.
+  batched: getmany and the bare native search
+    (find_index_positions) per label for a batch of labels.
+  iterate: full iteration over items() and label access.
+  select: the original benchmark, reading a random 10% of
+    the labels versus unpickling a dict.
+
+Examples:
+  python perf.py
+  python perf.py --sizes 1e2,1e4,1e6,1e8 --values fixed:16 --compress none
+  python perf.py --scenarios lookup,batched --mode mmap --format csv -o out.csv
 
+Large N needs a lot of memory for the dict builder (about
+100 bytes of Python objects per label plus the values).
+--builder writer streams the values instead.
+"""
+import argparse
+import csv
+import io
+import json
+import os
 import pickle
+import platform
+import sys
+import tempfile
+import time
+
+import numpy as np
+
+import mapbufferaccel
+from mapbuffer import MapBuffer, MapBufferWriter, FORMAT_VERSION
+from mapbuffer import compression
+from mapbuffer.mapbuffer import eytzinger_sort
 
-pf = open("pkl.tsv", "w+")
-mf = open("mb.tsv", "w+")
+SCENARIOS = ( "build", "lookup", "batched", "iterate", "select" )
 
-def test(datasize):
-  data = { 
-    random.randint(0, 1000000000): np.random.bytes(random.randint(0,100000)) 
-    for _ in range(datasize) 
+def parse_size(text):
+  return int(float(text))
+
+def value_lengths(spec, N, rng):
+  """
+  fixed:K      every value is K bytes
+  uniform:A:B  uniformly distributed in [A, B] bytes
+  lognormal:M  log-normally distributed with a mean near M bytes
+  """
+  kind, *args = spec.split(":")
+  if kind == "fixed":
+    return np.full((N,), int(args[0]), dtype=np.int64)
+  elif kind == "uniform":
+    return rng.integers(int(args[0]), int(args[1]) + 1, size=N, dtype=np.int64)
+  elif kind == "lognormal":
+    sigma = 1.0
+    mu = np.log(float(args[0])) - sigma ** 2 / 2
+    return rng.lognormal(mu, sigma, size=N).astype(np.int64)
+  raise ValueError(f"Unknown value distribution: {spec}")
+
+def make_dataset(N, spec, compressible, rng):
+  """Returns (labels, values) with unique random labels."""
+  labels = np.unique(rng.integers(0, 2 ** 63, size=N + N // 100 + 16, dtype=np.uint64))
+  labels = rng.permutation(labels)[:N]
+
+  lengths = value_lengths(spec, N, rng)
+  total = int(lengths.sum())
+  if compressible:
+    pool = rng.integers(0, 16, size=total, dtype=np.uint8).tobytes()
+  else:
+    pool = rng.bytes(total)
+
+  pool = memoryview(pool)
+  ends = np.cumsum(lengths)
+  starts = ends - lengths
+  values = [ bytes(pool[s:e]) for s, e in zip(starts, ends) ]
+  return labels, values
+
+def percentiles(samples_ns):
+  samples = np.asarray(samples_ns, dtype=np.float64)
+  return {
+    "mean_ns": float(samples.mean()),
+    "p50_ns": float(np.percentile(samples, 50)),
+    "p90_ns": float(np.percentile(samples, 90)),
+    "p99_ns": float(np.percentile(samples, 99)),
+    "p999_ns": float(np.percentile(samples, 99.9)),
+    "max_ns": float(samples.max()),
   }
 
-  labels = list(data.keys())
-  random.shuffle(labels)
-  labels = labels[:datasize//10]
+def build(labels, values, compress, args):
+  """Returns (serialized bytes, record of timings)."""
+  N = len(labels)
+  nbytes = sum(( len(v) for v in values ))
+  record = {}
+
+  sorted_labels = np.sort(labels)
+  out = np.zeros((N,), dtype=np.uint64)
+  s = time.perf_counter()
+  eytzinger_sort(sorted_labels, out)
+  record["eytzinger_sort_s"] = time.perf_counter() - s
+  del out, sorted_labels
+
+  if compress:
+    s = time.perf_counter()
+    compression.compress_many(values, compress, parallel=args.parallel)
+    record["compress_s"] = time.perf_counter() - s
+
+  s = time.perf_counter()
+  if args.builder == "writer":
+    f = io.BytesIO()
+    with MapBufferWriter(
+      f, compress=compress, format_version=args.format_version,
+      hash_index=args.hash_index, bloom_filter=args.bloom_filter
+    ) as writer:
+      for label, value in zip(labels, values):
+        writer.add(int(label), value)
+    binary = f.getvalue()
+  else:
+    data = dict(zip(labels.tolist(), values))
+    t_dict = time.perf_counter() - s
+    s = time.perf_counter()
+    binary = MapBuffer(
+      data, compress=compress,
+      format_version=args.format_version, parallel=args.parallel,
+      hash_index=args.hash_index, bloom_filter=args.bloom_filter
+    ).tobytes()
+    record["dict_s"] = t_dict
+    del data
+  elapsed = time.perf_counter() - s
+
+  record.update({
+    "build_s": elapsed,
+    "items_per_s": N / elapsed if elapsed else None,
+    "input_mb_per_s": nbytes / elapsed / 1e6 if elapsed else None,
+    "input_bytes": nbytes,
+    "output_bytes": len(binary),
+  })
+  return binary, record
 
+def open_buffer(binary, args, tmpdir):
+  if args.mode == "mmap":
+    path = os.path.join(tmpdir, "bench.mb")
+    with open(path, "wb") as f:
+      f.write(binary)
+    return MapBuffer.open(path)
+  return MapBuffer(binary)
+
+def bench_lookup(mb, labels, args, rng):
+  queries = rng.choice(labels, size=min(args.queries, len(labels)))
+  queries = [ int(x) for x in queries ]
+  samples = np.zeros((len(queries),), dtype=np.int64)
+  clock = time.perf_counter_ns
+  for i, label in enumerate(queries):
+    s = clock()
+    mb[label]
+    samples[i] = clock() - s
+  return { "queries": len(queries), **percentiles(samples) }
+
+def bench_batched(mb, labels, args, rng):
+  queries = rng.choice(labels, size=min(args.queries, len(labels)))
+  queries = np.ascontiguousarray(queries, dtype=np.uint64)
+
+  record = { "queries": len(queries) }
+  s = time.perf_counter()
+  mb.find_index_positions(queries)
+  record["search_ns_per_label"] = (time.perf_counter() - s) * 1e9 / len(queries)
+
+  s = time.perf_counter()
+  mb.getmany(queries, parallel=args.parallel)
+  record["getmany_ns_per_label"] = (time.perf_counter() - s) * 1e9 / len(queries)
+  return record
+
+def bench_iterate(mb, args):
+  N = len(mb)
+  record = {}
+  s = time.perf_counter()
+  mb.keys_array().sum()
+  record["keys_array_s"] = time.perf_counter() - s
+
+  s = time.perf_counter()
+  for _ in mb.keys():
+    pass
+  record["keys_s"] = time.perf_counter() - s
+
+  s = time.perf_counter()
+  for _ in mb.items(parallel=args.parallel):
+    pass
+  elapsed = time.perf_counter() - s
+  record["items_s"] = elapsed
+  record["items_per_s"] = N / elapsed if elapsed else None
+  return record
+
+def bench_select(binary, labels, values, rng):
+  """Read a random 10% of labels: pickle.loads vs MapBuffer."""
+  data = dict(zip(labels.tolist(), values))
+  queries = [ int(x) for x in rng.permutation(labels)[:max(len(labels) // 10, 1)] ]
   pkl = pickle.dumps(data)
-  s = time.time()
+  del data
+
+  s = time.perf_counter()
   dat = pickle.loads(pkl)
-  for label in labels:
+  for label in queries:
     dat[label]
-  t = time.time() - s
+  t_pickle = time.perf_counter() - s
+  del dat, pkl
+
+  s = time.perf_counter()
+  mb = MapBuffer(binary)
+  for label in queries:
+    mb[label]
+  t_mapbuffer = time.perf_counter() - s
+
+  return {
+    "queries": len(queries),
+    "pickle_s": t_pickle,
+    "mapbuffer_s": t_mapbuffer,
+  }
+
+def run(args):
+  rng = np.random.default_rng(args.seed)
+  environment = {
+    "python": platform.python_version(),
+    "machine": platform.machine(),
+    "prefetch_threshold": mapbufferaccel.PREFETCH_THRESHOLD,
+    "search_kernel": mapbufferaccel.search_kernel(),
+  }
+
+  with tempfile.TemporaryDirectory() as tmpdir:
+    for N in args.sizes:
+      for spec in args.values:
+        labels, values = make_dataset(N, spec, args.compressible, rng)
+        for compress in args.compress:
+          compress = None if compress == "none" else compress
+          base = {
+            "N": N, "values": spec, "compress": compress or "none",
+            "mode": args.mode, "format_version": args.format_version,
+            "builder": args.builder, "hash_index": args.hash_index,
+            "bloom_filter": args.bloom_filter,
+            **environment,
+          }
+          binary, record = build(labels, values, compress, args)
+          if "build" in args.scenarios:
+            yield { "scenario": "build", **base, **record }
+
+          mb = open_buffer(binary, args, tmpdir)
+          try:
+            for _ in range(args.repeat):
+              if "lookup" in args.scenarios:
+                yield { "scenario": "lookup", **base, **bench_lookup(mb, labels, args, rng) }
+              if "batched" in args.scenarios:
+                yield { "scenario": "batched", **base, **bench_batched(mb, labels, args, rng) }
+              if "iterate" in args.scenarios:
+                yield { "scenario": "iterate", **base, **bench_iterate(mb, args) }
+          finally:
+            mb.close()
+
+          if "select" in args.scenarios and not compress:
+            yield { "scenario": "select", **base, **bench_select(binary, labels, values, rng) }
+          del binary
 
-  pf.write(f"{datasize}\t{t*1000:.5f}\n")
-  pf.flush()
+def main():
+  parser = argparse.ArgumentParser(
+    description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter
+  )
+  parser.add_argument("--scenarios", default=",".join(SCENARIOS),
+    help="comma separated subset of: " + ", ".join(SCENARIOS))
+  parser.add_argument("--sizes", default="1e2,1e3,1e4,1e5,1e6",
+    help="comma separated numbers of labels (e.g. 1e2,1e8)")
+  parser.add_argument("--values", default="uniform:0:1000",
+    help="comma separated value size distributions: fixed:K, uniform:A:B, lognormal:MEAN")
+  parser.add_argument("--compress", default="none,gzip",
+    help="comma separated compression types (none for uncompressed)")
+  parser.add_argument("--compressible", action="store_true",
+    help="draw values from a 16 symbol alphabet instead of random bytes")
+  parser.add_argument("--mode", choices=("memory", "mmap"), default="memory",
+    help="read from bytes in memory or an mmapped temporary file")
+  parser.add_argument("--builder", choices=("dict", "writer"), default="dict",
+    help="build with MapBuffer(dict) or MapBufferWriter")
+  parser.add_argument("--format-version", type=int, default=None,
+    help=f"layout to write (default {FORMAT_VERSION}, or 1 with --hash-index or --bloom-filter)")
+  parser.add_argument("--hash-index", action="store_true",
+    help="build with a perfect hash index (format version 1)")
+  parser.add_argument("--bloom-filter", action="store_true",
+    help="build with a Bloom filter of the labels (format version 1)")
+  parser.add_argument("--queries", type=parse_size, default=10000,
+    help="labels queried by the lookup and batched scenarios")
+  parser.add_argument("--parallel", type=int, default=1)
+  parser.add_argument("--repeat", type=int, default=1,
+    help="repetitions of the read scenarios per buffer")
+  parser.add_argument("--seed", type=int, default=0)
+  parser.add_argument("--format", choices=("jsonl", "csv"), default="jsonl")
+  parser.add_argument("-o", "--output", default="-", help="output path (- for stdout)")
+  args = parser.parse_args()
 
-  mbuf = MapBuffer(data)
-  buf = mbuf.tobytes()
+  args.scenarios = [ x for x in args.scenarios.split(",") if x ]
+  for scenario in args.scenarios:
+    if scenario not in SCENARIOS:
+      parser.error(f"Unknown scenario: {scenario}")
+  args.sizes = [ parse_size(x) for x in args.sizes.split(",") ]
+  args.values = args.values.split(",")
+  args.compress = args.compress.split(",")
+  if args.format_version is None:
+    args.format_version = 1 if (args.hash_index or args.bloom_filter) else FORMAT_VERSION
 
-  s = time.time()
-  mbuf = MapBuffer(buf)
-  for label in labels:
-    mbuf[label]
-  t = time.time() - s 
-  mf.write(f"{datasize}\t{t*1000:.5f}\n")
-  mf.flush()
+  out = sys.stdout if args.output == "-" else open(args.output, "w", newline="")
+  try:
+    records = []
+    for record in run(args):
+      if args.format == "jsonl":
+        out.write(json.dumps(record) + "\n")
+        out.flush()
+      else:
+        records.append(record)
 
-for i in range(1,10000,50):
-  test(i)
+    if args.format == "csv":
+      # scenarios have different columns, so write one header 
+      # with all of them and leave the missing cells empty
+      fieldnames = {}
+      for record in records:
+        fieldnames.update(dict.fromkeys(record.keys()))
+      writer = csv.DictWriter(out, fieldnames=list(fieldnames), restval="")
+      writer.writeheader()
+      writer.writerows(records)
+  finally:
+    if out is not sys.stdout:
+      out.close()
 
-mf.close()
-pf.close()
\ No newline at end of file
+if __name__ == "__main__":
+  main()
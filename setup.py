@@ -1,10 +1,64 @@
-import setuptools
+import os
 import platform
+import tempfile
+
+import setuptools
 
 extra_compile_args = [ "-O3" ]
 if platform.system() == "Windows":
   extra_compile_args = [ "/O2" ]
 
+def native_codecs():
+  """
+  Link the codecs mapbufferaccel can decompress natively when
+  their libraries are installed: libdeflate (or zlib) for gzip
+  and libzstd for zstd. Set MAPBUFFER_NATIVE_CODECS=0 to build
+  without them. Returns (define_macros, libraries).
+  """
+  if platform.system() == "Windows" or os.environ.get("MAPBUFFER_NATIVE_CODECS", "1") == "0":
+    return [], []
+
+  try:
+    from distutils import ccompiler, sysconfig
+    compiler = ccompiler.new_compiler()
+    sysconfig.customize_compiler(compiler)
+  except Exception:
+    return [], []
+
+  def has(function, header, library):
+    """Can a program using function from header link against library?"""
+    with tempfile.TemporaryDirectory() as tmpdir:
+      source = os.path.join(tmpdir, "check.c")
+      with open(source, "w") as f:
+        f.write(
+          f"#include <{header}>\n"
+          f"int main(void) {{ return (void*)&{function} == (void*)0; }}\n"
+        )
+      try:
+        objects = compiler.compile([ source ], output_dir=tmpdir)
+        compiler.link_executable(
+          objects, os.path.join(tmpdir, "check"), libraries=[ library ]
+        )
+      except Exception:
+        return False
+    return True
+
+  macros, libraries = [], []
+  if has("libdeflate_gzip_decompress", "libdeflate.h", "deflate"):
+    macros.append(("MB_HAVE_LIBDEFLATE", "1"))
+    libraries.append("deflate")
+  elif has("inflate", "zlib.h", "z"):
+    macros.append(("MB_HAVE_ZLIB", "1"))
+    libraries.append("z")
+
+  if has("ZSTD_decompressDCtx", "zstd.h", "zstd"):
+    macros.append(("MB_HAVE_ZSTD", "1"))
+    libraries.append("zstd")
+
+  return macros, libraries
+
+define_macros, libraries = native_codecs()
+
 setuptools.setup(
   setup_requires=['pbr'],
   python_requires="~=3.6", # >= 3.6 < 4.0
@@ -15,8 +69,9 @@ setuptools.setup(
       sources=[ 'mapbufferaccel.c' ],
       language='c',
       extra_compile_args=extra_compile_args,
+      define_macros=define_macros,
+      libraries=libraries,
     )
   ],
   pbr=True
 )
-